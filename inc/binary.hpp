@@ -0,0 +1,204 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef _NET6_BINARY_HPP_
+#define _NET6_BINARY_HPP_
+
+#include <string>
+#include "serialise.hpp"
+
+namespace serialise
+{
+
+/** @brief Arbitrary binary data.
+ *
+ * The binary contexts copy it verbatim, the default and hexadecimal
+ * contexts write two hexadecimal digits per byte.
+ */
+class bytes
+{
+public:
+	bytes();
+	bytes(const std::string& data);
+	bytes(const void* data, std::size_t len);
+
+	/** Returns the data.
+	 */
+	const std::string& get_data() const;
+
+	/** Returns the amount of bytes.
+	 */
+	std::size_t get_size() const;
+
+	bool operator==(const bytes& other) const;
+	bool operator!=(const bytes& other) const;
+
+protected:
+	std::string m_data;
+};
+
+template<> struct type_name<bytes> { static const char* name; };
+
+/** @brief Binary encoding of built-in types.
+ *
+ * Unsigned integers are written as base 128 varints, signed integers are
+ * zigzag encoded first so that small negative numbers stay short. float
+ * and double are written as their IEEE 754 bit pattern in little endian
+ * byte order and bools as a single byte. serialise::bytes are prefixed by
+ * their length when appended to a sequence, but a single value is
+ * stored verbatim.
+ *
+ * The encoded data may contain any byte. net6 packets escape parameters,
+ * so it can be used as packet parameter directly.
+ */
+template<typename data_type>
+struct binary
+{
+	static const bool is_binary = false;
+};
+
+/** Conversion functions shared by all binary specialisations. They are
+ * instantiated in the library for the types binary is specialised for.
+ */
+template<typename data_type>
+struct binary_conversion
+{
+	static const bool is_binary = true;
+
+	/** Appends the encoded form of <em>from</em> as an element of a
+	 * sequence to <em>to</em>.
+	 */
+	static void append(std::string& to, const data_type& from);
+
+	/** Appends the encoded form of <em>from</em> as a single value to
+	 * <em>to</em>, which is what to_string returns.
+	 */
+	static void append_to(std::string& to, const data_type& from)
+	{
+		append(to, from);
+	}
+
+	/** Decodes a value starting at <em>begin</em> and advances
+	 * <em>begin</em> behind it. Throws conversion_error if there is no
+	 * valid value before <em>end</em>.
+	 */
+	static data_type read(const char*& begin, const char* end);
+
+	static std::string to_string(const data_type& from)
+	{
+		std::string result;
+		append_to(result, from);
+		return result;
+	}
+
+	/** Decodes <em>from</em>, which must contain exactly one value.
+	 */
+	static data_type from_string(const std::string& from);
+};
+
+template<> struct binary<int>: binary_conversion<int> {};
+template<> struct binary<long>: binary_conversion<long> {};
+template<> struct binary<short>: binary_conversion<short> {};
+template<> struct binary<unsigned int>:
+	binary_conversion<unsigned int> {};
+template<> struct binary<unsigned long>:
+	binary_conversion<unsigned long> {};
+template<> struct binary<unsigned short>:
+	binary_conversion<unsigned short> {};
+template<> struct binary<float>: binary_conversion<float> {};
+template<> struct binary<double>: binary_conversion<double> {};
+template<> struct binary<bool>: binary_conversion<bool> {};
+template<> struct binary<bytes>: binary_conversion<bytes> {};
+
+// A single bytes value is stored without its length prefix
+template<>
+void binary_conversion<bytes>::append_to(std::string& to, const bytes& from);
+template<> bytes binary_conversion<bytes>::from_string(const std::string& from);
+
+/** Context that converts a value to its binary encoding.
+ */
+template<typename data_type>
+class binary_context_to: public context_base_to<data_type>
+{
+public:
+	virtual std::string to_string(const data_type& from) const
+	{
+		return binary<data_type>::to_string(from);
+	}
+
+	virtual void append_to(std::string& to, const data_type& from) const
+	{
+		binary<data_type>::append_to(to, from);
+	}
+};
+
+/** Context that converts a binary encoded value back.
+ */
+template<typename data_type>
+class binary_context_from: public context_base_from<data_type>
+{
+public:
+	virtual data_type from_string(const std::string& from) const
+	{
+		return binary<data_type>::from_string(from);
+	}
+};
+
+/** @brief Compile-time counterpart of binary_context_to and
+ * binary_context_from.
+ */
+struct binary_ctx: public static_context
+{
+	template<typename data_type>
+	static std::string to_string(const data_type& from)
+	{
+		return binary<data_type>::to_string(from);
+	}
+
+	template<typename data_type>
+	static void append_to(std::string& to, const data_type& from)
+	{
+		binary<data_type>::append_to(to, from);
+	}
+
+	template<typename data_type>
+	static data_type from_string(const std::string& from)
+	{
+		return binary<data_type>::from_string(from);
+	}
+};
+
+template<>
+class default_context_to<bytes>: public context_base_to<bytes>
+{
+public:
+	virtual std::string to_string(const bytes& from) const;
+	virtual void append_to(std::string& to, const bytes& from) const;
+};
+
+template<>
+class default_context_from<bytes>: public context_base_from<bytes>
+{
+public:
+	virtual bytes from_string(const std::string& from) const;
+};
+
+} // namespace serialise
+
+#endif // _NET6_BINARY_HPP_
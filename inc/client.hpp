@@ -28,6 +28,7 @@
 #include "socket.hpp"
 #include "select.hpp"
 #include "packet.hpp"
+#include "packet_type.hpp"
 #include "connection.hpp"
 #include "local.hpp"
 
@@ -48,6 +49,10 @@ public:
 		signal_part_type;
 	typedef sigc::signal<void, const packet&>
 		signal_data_type;
+	typedef sigc::signal<void>
+		signal_connected_type;
+	typedef sigc::signal<void, const error&>
+		signal_connect_failed_type;
 	typedef sigc::signal<void>
 		signal_close_type;
 	typedef sigc::signal<void>
@@ -76,10 +81,25 @@ public:
 	 */
 	virtual void connect(const address& addr);
 
+	/** Starts to connect to the given address without blocking. A
+	 * connected_event is emitted when the connection has been
+	 * established, and a connect_failed_event if that failed. The client
+	 * counts as connected in the meantime, packets sent to the server
+	 * are queued until the connection is established.
+	 */
+	virtual void connect_async(const address& addr);
+
 	/** Disconnects from the server.
 	 */
 	virtual void disconnect();
 
+	/** @brief Disconnects from the server after all queued packets have
+	 * been sent, see connection_base::close_after_flush.
+	 *
+	 * The client stays connected until close_event is emitted.
+	 */
+	void disconnect_after_flush(unsigned long timeout);
+
 	/** Determinates if the client is connected to a server.
 	 */
 	bool is_connected() const;
@@ -89,6 +109,10 @@ public:
 	 */
 	void request_encryption();
 
+	/** Requests compression of the traffic to and from the server.
+	 */
+	void request_compression();
+
 	/** Send a login request with the specified user name. On success,
 	 * a join_event with user==self is emitted, otherwise a
 	 * login_failed_event.
@@ -103,6 +127,17 @@ public:
 	 */
 	virtual void send(const packet& pack);
 
+	/** @brief Sends a packet to the network server, the connection
+	 * emits packet_sent_event with <em>token</em> when it has been
+	 * sent.
+	 */
+	void send(const packet& pack, unsigned long token);
+
+	/** @brief Sends a packet with the given priority to the network
+	 * server, see connection_base::send.
+	 */
+	void send(const packet& pack, connection_base::send_priority priority);
+
 	/** Returns the user object which represents the
 	 * local host in the network.
 	 */
@@ -134,6 +169,17 @@ public:
 	 */
 	signal_data_type data_event() const;
 
+	/** Signal which is emitted when a connection started with
+	 * connect_async() has been established.
+	 */
+	signal_connected_type connected_event() const;
+
+	/** Signal which is emitted when a connection started with
+	 * connect_async() could not be established. The client is in
+	 * disconnected state when the signal is emitted.
+	 */
+	signal_connect_failed_type connect_failed_event() const;
+
 	/** Signal which is emitted when the connection to the server has
 	 * been lost. The client will end up in disconnected state after having
 	 * received this event.
@@ -168,6 +214,12 @@ protected:
 	 */
 	void on_close_event();
 
+	/** Signal handler that is called when an asynchronous connection
+	 * attempt has finished.
+	 */
+	void on_connected_event();
+	void on_connect_failed_event(const error& err);
+
 	/** Signal handler that is called when a secure connection is
 	 * guaranteed to be secure.
 	 */
@@ -177,6 +229,8 @@ protected:
 	virtual void on_part(const user& user, const packet& pack);
 	virtual void on_data(const packet& pack);
 	virtual void on_close();
+	virtual void on_connected();
+	virtual void on_connect_failed(const error& err);
 	virtual void on_encrypted();
 	virtual void on_login_failed(login::error error);
 	virtual void on_login_extend(packet& pack);
@@ -186,19 +240,21 @@ protected:
 	void net_client_part(const packet& pack);
 	void net_encryption_info(const packet& pack);
 
-	std::auto_ptr<connection_type> conn;
+	std::unique_ptr<connection_type> conn;
 	user* self;
 
 	signal_join_type signal_join;
 	signal_part_type signal_part;
 	signal_data_type signal_data;
+	signal_connected_type signal_connected;
+	signal_connect_failed_type signal_connect_failed;
 	signal_close_type signal_close;
 	signal_encrypted_type signal_encrypted;
 	signal_login_failed_type signal_login_failed;
 	signal_login_extend_type signal_login_extend;
 
 private:
-	void connect_impl(const address& addr);
+	void connect_impl(const address& addr, bool blocking);
 	void disconnect_impl();
 };
 
@@ -214,7 +270,7 @@ template<typename selector_type>
 basic_client<selector_type>::basic_client(const net6::address& addr):
 	basic_local<selector_type>(), self(NULL)
 {
-	connect_impl(addr);
+	connect_impl(addr, true);
 }
 
 template<typename selector_type>
@@ -227,7 +283,13 @@ basic_client<selector_type>::~basic_client()
 template<typename selector_type>
 void basic_client<selector_type>::connect(const net6::address& addr)
 {
-	connect_impl(addr);
+	connect_impl(addr, true);
+}
+
+template<typename selector_type>
+void basic_client<selector_type>::connect_async(const net6::address& addr)
+{
+	connect_impl(addr, false);
 }
 
 template<typename selector_type>
@@ -236,6 +298,19 @@ void basic_client<selector_type>::disconnect()
 	disconnect_impl();
 }
 
+template<typename selector_type>
+void basic_client<selector_type>::disconnect_after_flush(unsigned long timeout)
+{
+	if(conn.get() == NULL)
+	{
+		throw not_connected_error(
+			"net6::basic_client::disconnect_after_flush"
+		);
+	}
+
+	conn->close_after_flush(timeout);
+}
+
 template<typename selector_type>
 bool basic_client<selector_type>::is_connected() const
 {
@@ -252,6 +327,12 @@ void basic_client<selector_type>::request_encryption()
 	conn->request_encryption(true);
 }
 
+template<typename selector_type>
+void basic_client<selector_type>::request_compression()
+{
+	conn->request_compression();
+}
+
 template<typename selector_type>
 void basic_client<selector_type>::login(const std::string& username)
 {
@@ -274,6 +355,20 @@ void basic_client<selector_type>::send(const packet& pack)
 	conn->send(pack);
 }
 
+template<typename selector_type>
+void basic_client<selector_type>::send(const packet& pack,
+                                       unsigned long token)
+{
+	conn->send(pack, token);
+}
+
+template<typename selector_type>
+void basic_client<selector_type>::
+	send(const packet& pack, connection_base::send_priority priority)
+{
+	conn->send(pack, priority);
+}
+
 template<typename selector_type>
 user& basic_client<selector_type>::get_self()
 {
@@ -338,6 +433,20 @@ basic_client<selector_type>::data_event() const
 	return signal_data;
 }
 
+template<typename selector_type>
+typename basic_client<selector_type>::signal_connected_type
+basic_client<selector_type>::connected_event() const
+{
+	return signal_connected;
+}
+
+template<typename selector_type>
+typename basic_client<selector_type>::signal_connect_failed_type
+basic_client<selector_type>::connect_failed_event() const
+{
+	return signal_connect_failed;
+}
+
 template<typename selector_type>
 typename basic_client<selector_type>::signal_close_type
 basic_client<selector_type>::close_event() const
@@ -390,6 +499,20 @@ void basic_client<selector_type>::on_close_event()
 	on_close();
 }
 
+template<typename selector_type>
+void basic_client<selector_type>::on_connected_event()
+{
+	on_connected();
+}
+
+template<typename selector_type>
+void basic_client<selector_type>::on_connect_failed_event(const error& err)
+{
+	// The connection has already been closed, drop it
+	disconnect();
+	on_connect_failed(err);
+}
+
 template<typename selector_type>
 void basic_client<selector_type>::on_encrypted_event()
 {
@@ -420,6 +543,18 @@ void basic_client<selector_type>::on_close()
 	signal_close.emit();
 }
 
+template<typename selector_type>
+void basic_client<selector_type>::on_connected()
+{
+	signal_connected.emit();
+}
+
+template<typename selector_type>
+void basic_client<selector_type>::on_connect_failed(const error& err)
+{
+	signal_connect_failed.emit(err);
+}
+
 template<typename selector_type>
 void basic_client<selector_type>::on_encrypted()
 {
@@ -442,20 +577,19 @@ template<typename selector_type>
 void basic_client<selector_type>::net_login_failed(const packet& pack)
 {
 	// Received login_failed packet
-	on_login_failed(
-		static_cast<login::error>(
-			pack.get_param(0).parameter::as<int>()
-		)
-	);
+	int error = std::get<0>(packet_type<int>::decode(pack) );
+	on_login_failed(static_cast<login::error>(error) );
 }
 
 template<typename selector_type>
 void basic_client<selector_type>::net_client_join(const packet& pack)
 {
 	// Received client_join packet
-	unsigned int id = pack.get_param(0).parameter::as<int>();
-	std::string name = pack.get_param(1).parameter::as<std::string>();
-	bool is_encrypted = pack.get_param(2).parameter::as<bool>();
+	unsigned int id;
+	std::string name;
+	bool is_encrypted;
+	std::tie(id, name, is_encrypted) =
+		packet_type<unsigned int, std::string, bool>::decode(pack);
 
 	user* new_client = new user(id, NULL);
 	basic_object<selector_type>::user_add(new_client);
@@ -474,7 +608,7 @@ void basic_client<selector_type>::net_client_join(const packet& pack)
 template<typename selector_type>
 void basic_client<selector_type>::net_client_part(const packet& pack)
 {
-	unsigned int id = pack.get_param(0).parameter::as<int>();
+	unsigned int id = std::get<0>(packet_type<unsigned int>::decode(pack) );
 	user* rem_user = basic_object<selector_type>::user_find(id);
 
 	if(rem_user == NULL)
@@ -487,7 +621,7 @@ void basic_client<selector_type>::net_client_part(const packet& pack)
 template<typename selector_type>
 void basic_client<selector_type>::net_encryption_info(const packet& pack)
 {
-	unsigned int id = pack.get_param(0).parameter::as<int>();
+	unsigned int id = std::get<0>(packet_type<unsigned int>::decode(pack) );
 	user* encr_user = basic_object<selector_type>::user_find(id);
 
 	if(encr_user == NULL)
@@ -497,7 +631,8 @@ void basic_client<selector_type>::net_encryption_info(const packet& pack)
 }
 
 template<typename selector_type>
-void basic_client<selector_type>::connect_impl(const address& addr)
+void basic_client<selector_type>::connect_impl(const address& addr,
+                                               bool blocking)
 {
 	// Cannot connect twice
 	if(is_connected() )
@@ -517,11 +652,18 @@ void basic_client<selector_type>::connect_impl(const address& addr)
 		sigc::mem_fun(*this, &basic_client::on_close_event) );
 	conn->encrypted_event().connect(
 		sigc::mem_fun(*this, &basic_client::on_encrypted_event) );
+	conn->connected_event().connect(
+		sigc::mem_fun(*this, &basic_client::on_connected_event) );
+	conn->connect_failed_event().connect(
+		sigc::mem_fun(*this, &basic_client::on_connect_failed_event) );
 
 	try {
-		conn->connect(addr);
+		if(blocking)
+			conn->connect(addr);
+		else
+			conn->connect_async(addr);
 	} catch(net6::error& e) {
-		conn.reset(NULL);
+		conn.reset();
 		throw e;
 	}
 }
@@ -537,7 +679,7 @@ void basic_client<selector_type>::
 	// TODO: Remove socket from selector?
 
 	// Reset connection, clear user list, clear self pointer
-	conn.reset(NULL);
+	conn.reset();
 	basic_client<selector_type>::user_clear();
 	self = NULL;
 }
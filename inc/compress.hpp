@@ -0,0 +1,112 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _NET6_COMPRESS_HPP_
+#define _NET6_COMPRESS_HPP_
+
+#include <inttypes.h>
+#include <stdexcept>
+#include "non_copyable.hpp"
+#include "queue.hpp"
+
+// Avoid exporting zlib.h to library users
+struct z_stream_s;
+
+namespace net6
+{
+
+/** Error that is thrown if the remote site sent data that could not be
+ * decompressed.
+ */
+class compression_error: public std::runtime_error
+{
+public:
+	compression_error(const std::string& message):
+		std::runtime_error(message) {}
+};
+
+/** Pair of zlib streams that compress outgoing and decompress incoming
+ * data of a connection.
+ *
+ * Each call to deflate finishes with a sync flush, so the remote site is
+ * able to decompress everything that has been passed to deflate so far.
+ */
+class deflate_stream: private non_copyable
+{
+public:
+	typedef queue::size_type size_type;
+
+	deflate_stream();
+	~deflate_stream();
+
+	/** @brief Compresses <em>len</em> bytes starting at <em>data</em>
+	 * and appends the result to <em>to</em>.
+	 */
+	void deflate(const char* data, size_type len, queue& to);
+
+	/** @brief Decompresses <em>len</em> bytes starting at <em>data</em>
+	 * and appends the result to <em>to</em>.
+	 *
+	 * Throws compression_error if the data is corrupt.
+	 */
+	void inflate(const char* data, size_type len, queue& to);
+
+	/** @brief Decompresses data starting at <em>data</em> until
+	 * <em>to</em> holds at least <em>limit</em> bytes or all
+	 * <em>len</em> bytes have been used.
+	 *
+	 * Returns how many bytes of the input have been used. The rest
+	 * has to be passed again later. Throws compression_error if the
+	 * data is corrupt.
+	 */
+	size_type inflate(const char* data,
+	                  size_type len,
+	                  queue& to,
+	                  size_type limit);
+
+	/** @brief Returns the amount of uncompressed bytes that have been
+	 * passed to deflate.
+	 */
+	uint64_t get_deflate_in() const;
+
+	/** @brief Returns the amount of compressed bytes deflate produced.
+	 */
+	uint64_t get_deflate_out() const;
+
+	/** @brief Returns the amount of compressed bytes that have been
+	 * passed to inflate.
+	 */
+	uint64_t get_inflate_in() const;
+
+	/** @brief Returns the amount of uncompressed bytes inflate produced.
+	 */
+	uint64_t get_inflate_out() const;
+
+protected:
+	z_stream_s* deflate_strm;
+	z_stream_s* inflate_strm;
+
+	uint64_t deflate_in;
+	uint64_t deflate_out;
+	uint64_t inflate_in;
+	uint64_t inflate_out;
+};
+
+} // namespace net6
+
+#endif // _NET6_COMPRESS_HPP_
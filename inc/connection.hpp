@@ -19,18 +19,65 @@
 #ifndef _NET6_CONNECTION_HPP_
 #define _NET6_CONNECTION_HPP_
 
+#include <deque>
 #include <memory>
+#include <sys/types.h>
+#include <inttypes.h>
 #include <sigc++/signal.h>
 
 #include "non_copyable.hpp"
 #include "socket.hpp"
 #include "encrypt.hpp"
+#include "compress.hpp"
 #include "queue.hpp"
 #include "packet.hpp"
+#include "token_bucket.hpp"
 
 namespace net6
 {
 
+/** @brief Traffic counters of a connection, or the sum of the counters
+ * of several connections.
+ *
+ * Byte counts refer to the data passed to and from the socket, that is
+ * after compression and before encryption. The TLS handshake itself is
+ * not counted.
+ */
+struct connection_stats
+{
+	connection_stats();
+
+	/** @brief Adds the counters of <em>other</em>. The peak queue sizes
+	 * are the maximum of both.
+	 */
+	connection_stats& operator+=(const connection_stats& other);
+
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t packets_in;
+	uint64_t packets_out;
+
+	/** Number of reads from and writes to the socket.
+	 */
+	uint64_t recv_calls;
+	uint64_t send_calls;
+
+	queue::size_type peak_sendqueue;
+	queue::size_type peak_recvqueue;
+
+	/** Milliseconds outgoing data has been waiting for the socket to
+	 * become writable.
+	 */
+	uint64_t outgoing_wait;
+
+	/** Number of connections that are established, and how many of
+	 * them are encrypted and compressed.
+	 */
+	unsigned int connections;
+	unsigned int encrypted;
+	unsigned int compressed;
+};
+
 /** Abstract base connection class. Instantiate net6::connection.
  */
 class connection_base: public sigc::trackable, private non_copyable
@@ -44,13 +91,47 @@ public:
 		ENCRYPTION_REQUESTED_SERVER,
 		ENCRYPTION_HANDSHAKING,
 		ENCRYPTED,
-		CLOSED
+		CLOSED,
+		CONNECTING
 	};
 
 	enum keepalive_state {
 		KEEPALIVE_DISABLED,
 		KEEPALIVE_ENABLED,
-		KEEPALIVE_WAITING
+		KEEPALIVE_WAITING,
+		KEEPALIVE_KERNEL
+	};
+
+	/** How the connection finds out whether the remote site is still
+	 * alive, see connection_base::set_enable_keepalives.
+	 */
+	enum keepalive_mode {
+		KEEPALIVE_PACKETS,
+		KEEPALIVE_OFFLOADED
+	};
+
+	enum compression_state {
+		COMPRESSION_DISABLED,
+		COMPRESSION_REQUESTED,
+		COMPRESSION_ENABLED
+	};
+
+	/** Priority classes of outgoing packets, see
+	 * connection_base::send.
+	 */
+	enum send_priority {
+		PRIORITY_INTERACTIVE,
+		PRIORITY_NORMAL,
+		PRIORITY_BULK
+	};
+
+	/** Position of a chunk of a streamed parameter, see
+	 * connection_base::set_stream_threshold.
+	 */
+	enum chunk_position {
+		CHUNK_PARTIAL,
+		CHUNK_PARAM_END,
+		CHUNK_FRAME_END
 	};
 
 	class fatal: public std::runtime_error
@@ -60,11 +141,22 @@ public:
 			std::runtime_error(error_message) {}
 	};
 
+	typedef sigc::signal<void> signal_connected_type;
+	typedef sigc::signal<void, const error&> signal_connect_failed_type;
 	typedef sigc::signal<void, const packet&> signal_recv_type;
 	typedef sigc::signal<void> signal_send_type;
+	typedef sigc::signal<void, unsigned long> signal_packet_sent_type;
 	typedef sigc::signal<void> signal_close_type;
 	typedef sigc::signal<void> signal_encrypted_type;
 	typedef sigc::signal<void> signal_encryption_failed_type;
+	typedef sigc::signal<void> signal_compressed_type;
+	typedef sigc::signal<void> signal_compression_failed_type;
+	typedef sigc::signal<void> signal_frame_too_large_type;
+	typedef sigc::signal<void, const packet&, unsigned int,
+	                     const std::string&, chunk_position>
+		signal_param_chunk_type;
+	typedef sigc::signal<void, int, queue::size_type, queue::size_type>
+		signal_file_progress_type;
 
 	/** @brief Creates a new connection that is initially in closed
 	 * state.
@@ -77,9 +169,20 @@ public:
 	 */
 	void connect(const address& addr);
 
+	/** @brief Starts to connect to the given address if the connection
+	 * is closed, without waiting for the connection to be established.
+	 *
+	 * connected_event is emitted as soon as the connection has been
+	 * established, connect_failed_event if that is not possible.
+	 * Packets may be sent in the meantime, they are queued until the
+	 * connection is established. Encryption and compression can only
+	 * be requested afterwards.
+	 */
+	void connect_async(const address& addr);
+
 	/** @brief Wraps the given socket into this connection.
 	 */
-	void assign(std::auto_ptr<tcp_client_socket> sock,
+	void assign(std::unique_ptr<tcp_client_socket> sock,
 	            const address& addr);
 
 	/** Returns the remote internet address.
@@ -95,6 +198,20 @@ public:
 	 */
 	void set_enable_keepalives(bool enable);
 
+	/** @brief Sets whether and how the connection shall send keepalives
+	 * to the remote site if the connection is idle.
+	 *
+	 * KEEPALIVE_PACKETS sends net6_ping packets, which needs a timer
+	 * that is refreshed whenever data arrives. KEEPALIVE_OFFLOADED
+	 * lets the kernel send TCP keepalive probes with the same timing
+	 * instead and limits how long sent data may remain unacknowledged
+	 * (TCP_USER_TIMEOUT), unless a timeout has been configured already,
+	 * see tcp_options. The connection is then closed by a failing
+	 * read or write. If the socket does not support this,
+	 * keepalive packets are used.
+	 */
+	void set_enable_keepalives(bool enable, keepalive_mode mode);
+
 	/** @brief Returns whether the connection sends keepalives to the
 	 * remote site.
 	 */
@@ -104,6 +221,122 @@ public:
 	 */
 	void send(const packet& pack);
 
+	/** Queues a packet that is no longer needed by the caller.
+	 */
+	void send(packet&& pack);
+
+	/** @brief Queues a packet to send it to the remote host and emits
+	 * packet_sent_event with <em>token</em> when it has been sent.
+	 *
+	 * This allows to queue more data as soon as a certain packet has
+	 * left instead of waiting until everything has been sent.
+	 */
+	void send(const packet& pack, unsigned long token);
+
+	/** @brief Queues a packet with the given priority.
+	 *
+	 * Each priority has its own queue. When more data is waiting than
+	 * can be sent at once, packets are taken from the queues in turn,
+	 * with the amount of data taken from a queue in proportion to its
+	 * weight, see set_priority_weight. Packets of the same priority
+	 * are sent in order. The other send overloads use
+	 * PRIORITY_NORMAL. Data of send_file() and packet_writer is not
+	 * scheduled, it is sent behind the data that has already been
+	 * taken from the queues and behind all packets of PRIORITY_NORMAL
+	 * queued before.
+	 */
+	void send(const packet& pack, send_priority priority);
+
+	/** @brief Queues a packet with the given priority and emits
+	 * packet_sent_event with <em>token</em> when it has been sent.
+	 */
+	void send(const packet& pack,
+	          send_priority priority,
+	          unsigned long token);
+
+	/** @brief Sets the share of the bandwidth packets of the given
+	 * priority get when packets of several priorities are waiting.
+	 *
+	 * The default weights are 16 for PRIORITY_INTERACTIVE, 4 for
+	 * PRIORITY_NORMAL and 1 for PRIORITY_BULK. Zero is not allowed.
+	 */
+	void set_priority_weight(send_priority priority, unsigned int weight);
+
+	/** @brief Returns the weight of the given priority.
+	 */
+	unsigned int get_priority_weight(send_priority priority) const;
+
+	/** @brief Sends a packet that has been waiting longer than
+	 * <em>msec</em> milliseconds next, regardless of the weights.
+	 *
+	 * This keeps low priorities from being starved by a steady stream
+	 * of packets with higher priority. A value of zero, the default,
+	 * disables the limit.
+	 */
+	void set_max_starvation(unsigned long msec);
+
+	/** @brief Returns the time after which waiting packets are sent
+	 * next, or zero if there is no limit.
+	 */
+	unsigned long get_max_starvation() const;
+
+	/** @brief Sends <em>len</em> bytes of the file <em>fd</em>,
+	 * starting at <em>offset</em>, after the packet <em>header</em>.
+	 *
+	 * The file body is sent verbatim instead of being escaped. On
+	 * unencrypted and uncompressed connections, it is not read into
+	 * memory either but passed to the socket by sendfile(2) when all
+	 * data queued before has been sent. Otherwise, it is read into the
+	 * send queue right away. file_progress_event reports how much of
+	 * the file has been sent, <em>fd</em> must stay open until it
+	 * reports the whole file or the connection is closed.
+	 *
+	 * The remote site receives the file as a chunked parameter behind
+	 * the parameters of <em>header</em>, see param_chunk_event.
+	 */
+	void send_file(const packet& header,
+	               int fd,
+	               off_t offset,
+	               queue::size_type len);
+
+	/** @brief Closes the connection after all queued data has been
+	 * sent.
+	 *
+	 * No more packets may be sent afterwards. When all data has been
+	 * written to the socket, the connection is shut down for sending
+	 * and closed as soon as the remote site closes it as well. Packets
+	 * the remote site sends in the meantime are still received.
+	 * close_event is emitted when the connection has been closed, or
+	 * when this has not happened within <em>timeout</em> milliseconds.
+	 * A timeout of zero waits without limit. Data held back by cork()
+	 * is not sent until uncork() has been called.
+	 */
+	void close_after_flush(unsigned long timeout);
+
+	/** @brief Returns whether the connection is being closed by
+	 * close_after_flush().
+	 */
+	bool is_flushing() const;
+
+	/** @brief Holds back outgoing data until uncork() has been called
+	 * as often as cork().
+	 *
+	 * This allows to send many small packets in one go, for example
+	 * when replying to a single event with multiple packets. Note that
+	 * nothing is sent while the connection is corked, including
+	 * keepalives and replies to encryption requests.
+	 */
+	void cork();
+
+	/** @brief Releases a cork() call. If this was the last one, all
+	 * data that has been held back is sent.
+	 */
+	void uncork();
+
+	/** @brief Returns whether outgoing data is currently held back.
+	 */
+	bool is_corked() const;
+
 	/** @brief Requests a secure connection to the remote end.
 	 *
 	 * signal_encrypted will be emitted when further traffic will be
@@ -131,16 +364,181 @@ public:
 	 */
 	void set_dh_params(dh_params& new_params);
 
+	/** @brief Requests that further traffic in both directions is
+	 * compressed.
+	 *
+	 * signal_compressed will be emitted as soon as the remote site
+	 * agreed. Compression cannot be requested while an encryption
+	 * request is pending.
+	 */
+	void request_compression();
+
+	/** @brief Returns whether traffic on this connection is
+	 * compressed.
+	 */
+	bool is_compressed() const;
+
+	/** @brief Returns the zlib streams used to compress the traffic,
+	 * or NULL if the connection is not compressed.
+	 *
+	 * The stream keeps track of the amount of data before and after
+	 * compression.
+	 */
+	const deflate_stream* get_deflate_stream() const;
+
+	/** @brief Sets the maximum size of a single packet that the remote
+	 * site may send.
+	 *
+	 * The connection is closed after frame_too_large_event has been
+	 * emitted if a packet exceeds this size. Without a limit, which is
+	 * the default, a remote site that never terminates a packet makes
+	 * the receive buffer grow without bounds. A value of zero disables
+	 * the limit.
+	 */
+	void set_max_frame_size(queue::size_type size);
+
+	/** @brief Returns the maximum packet size, or zero if there is no
+	 * limit.
+	 */
+	queue::size_type get_max_frame_size() const;
+
+	/** @brief Delivers packets that grow larger than <em>size</em> in
+	 * chunks instead of buffering them completely.
+	 *
+	 * When an incomplete packet exceeds this size, the parameters that
+	 * have been received completely are put into a header packet and
+	 * all further data of the packet is passed to param_chunk_event as
+	 * it arrives, together with the header, the index of the parameter
+	 * the data belongs to and whether the parameter or the whole packet
+	 * ends with the chunk. Such a packet is not emitted by recv_event.
+	 * The maximum frame size does not apply to streamed data. A value of
+	 * zero, the default, disables streaming.
+	 */
+	void set_stream_threshold(queue::size_type size);
+
+	/** @brief Returns the size from which on packets are streamed, or
+	 * zero if streaming is disabled.
+	 */
+	queue::size_type get_stream_threshold() const;
+
+	/** @brief Sets the maximum amount of data that is read from the
+	 * socket at once.
+	 *
+	 * The connection starts with small reads and doubles the read size
+	 * whenever a read fills it completely, up to this limit. While it
+	 * is above the minimum, the amount the kernel has buffered is
+	 * queried with FIONREAD and read at once. The default is 256 KiB,
+	 * zero is not allowed.
+	 */
+	void set_max_recv_size(queue::size_type size);
+
+	/** @brief Returns the maximum amount of data that is read from the
+	 * socket at once.
+	 */
+	queue::size_type get_max_recv_size() const;
+
+	/** @brief Limits the rate at which data is read from the socket to
+	 * <em>rate</em> bytes per second, zero removes the limit.
+	 *
+	 * The connection stops selecting for incoming data while the limit
+	 * is exceeded, so the remote site cannot make us spend more time on
+	 * it. <em>burst</em> is the amount of data that may be read at once
+	 * after a quiet period, zero means one second worth of data.
+	 */
+	void set_recv_rate(queue::size_type rate, queue::size_type burst = 0);
+
+	/** @brief Returns the maximum receive rate in bytes per second, or
+	 * zero if the rate is not limited.
+	 */
+	queue::size_type get_recv_rate() const;
+
+	/** @brief Limits the rate at which data is written to the socket to
+	 * <em>rate</em> bytes per second, zero removes the limit.
+	 *
+	 * Outgoing data stays queued while the limit is exceeded.
+	 */
+	void set_send_rate(queue::size_type rate, queue::size_type burst = 0);
+
+	/** @brief Returns the maximum send rate in bytes per second, or
+	 * zero if the rate is not limited.
+	 */
+	queue::size_type get_send_rate() const;
+
+	/** @brief Additionally limits the receive rate by a bucket that may
+	 * be shared with other connections, or no longer if <em>bucket</em>
+	 * is NULL.
+	 *
+	 * The bucket is not copied, so it has to exist as long as the
+	 * connection uses it.
+	 */
+	void set_shared_recv_limit(token_bucket* bucket);
+
+	/** @brief Additionally limits the send rate by a bucket that may be
+	 * shared with other connections, or no longer if <em>bucket</em> is
+	 * NULL.
+	 */
+	void set_shared_send_limit(token_bucket* bucket);
+
+	/** @brief Sends data without copying it into the kernel once at
+	 * least <em>size</em> bytes are ready to be sent.
+	 *
+	 * Uses MSG_ZEROCOPY, which only pays off for large amounts of data.
+	 * The data is kept until the kernel reports that it has been
+	 * transmitted. If the connection is closed before, the socket stays
+	 * open in the background until then, but is shut down for sending.
+	 * Has no effect on encrypted connections or if the platform does
+	 * not support it. A value of zero, the default, disables zero-copy
+	 * sending.
+	 */
+	void set_zerocopy_threshold(queue::size_type size);
+
+	/** @brief Returns the size from which on data is sent without
+	 * copying, or zero if zero-copy sending is disabled.
+	 */
+	queue::size_type get_zerocopy_threshold() const;
+
+	/** @brief Returns the traffic counters since the connection has
+	 * been established.
+	 *
+	 * The counters are kept after the connection has been closed,
+	 * until it is established again.
+	 */
+	connection_stats get_stats() const;
+
+	/** @brief Signal which is emitted when a connection that has been
+	 * started with connect_async() has been established.
+	 */
+	signal_connected_type connected_event() const;
+
+	/** @brief Signal which is emitted when a connection that has been
+	 * started with connect_async() could not be established.
+	 *
+	 * The connection is closed again when the signal is emitted, but
+	 * close_event is not emitted.
+	 */
+	signal_connect_failed_type connect_failed_event() const;
+
 	/** Signal which is emitted when a packet has been received.
 	 */
 	signal_recv_type recv_event() const;
 
 	/** Signal that is emitted when all available data has been sent.
 	 *
-	 * TODO: Change this into a send signal for each packet.
+	 * Use packet_sent_event to find out when a single packet has been
+	 * sent.
 	 */
 	signal_send_type send_event() const;
 
+	/** @brief Signal which is emitted with the token passed to send()
+	 * as soon as the last byte of the packet has been handed to the
+	 * kernel.
+	 *
+	 * The remote site may not have received the packet yet. The signal
+	 * is not emitted for packets that are discarded because the
+	 * connection is closed before.
+	 */
+	signal_packet_sent_type packet_sent_event() const;
+
 	/** Signal which is emitted when the connection has been lost. Note
 	 * that the connection is invalid after the close event occured!
 	 */
@@ -156,6 +554,34 @@ public:
 	 */
 	signal_encryption_failed_type encryption_failed_event() const;
 
+	/** @brief Signal which is emitted when further traffic on the
+	 * connection is compressed.
+	 */
+	signal_compressed_type compressed_event() const;
+
+	/** @brief Signal that will be emitted when a compression request
+	 * has been denied.
+	 */
+	signal_compression_failed_type compression_failed_event() const;
+
+	/** @brief Signal which is emitted before the connection is closed
+	 * because the remote site sent a packet that exceeds the maximum
+	 * frame size.
+	 */
+	signal_frame_too_large_type frame_too_large_event() const;
+
+	/** @brief Signal which is emitted with a chunk of a packet that is
+	 * too large to be buffered, see set_stream_threshold, or with a
+	 * chunk of a file sent by send_file.
+	 */
+	signal_param_chunk_type param_chunk_event() const;
+
+	/** @brief Signal which is emitted with the file descriptor, the
+	 * amount of data sent and the total size when a part of a file
+	 * passed to send_file() has been sent.
+	 */
+	signal_file_progress_type file_progress_event() const;
+
 protected:
 	virtual void set_select(io_condition cond) = 0;
 	virtual io_condition get_select() const = 0;
@@ -170,41 +596,293 @@ protected:
 	queue sendqueue;
 	queue recvqueue;
 
+	/** Data that is ready to be written to the socket as-is, that is
+	 * already compressed data or data that has been queued before
+	 * compression was enabled.
+	 */
+	queue wirequeue;
+
+	/** Compressed data that has been received but not yet been
+	 * inflated into recvqueue.
+	 */
+	queue recvbuffer;
+
+	enum flush_state {
+		FLUSH_NONE,
+		FLUSH_PENDING,
+		FLUSH_SHUTDOWN
+	};
+
+	enum zerocopy_state {
+		ZEROCOPY_UNKNOWN,
+		ZEROCOPY_AVAILABLE,
+		ZEROCOPY_UNAVAILABLE
+	};
+
+	/** Data that is sent with MSG_ZEROCOPY. It must be kept until the
+	 * kernel has completed all sends from it.
+	 */
+	struct zerocopy_segment
+	{
+		std::unique_ptr<queue> data;
+		queue::size_type sent;
+
+		/** Number of zero-copy sends made on the connection up to
+		 * and including the last one from this segment.
+		 */
+		unsigned long last_send;
+	};
+
+	/** A file that is sent by send_file() but not yet completely
+	 * handed to the socket.
+	 */
+	struct file_transfer
+	{
+		int fd;
+		off_t offset;
+		queue::size_type remaining;
+		queue::size_type total;
+
+		/** Amount of data at the beginning of sendqueue that has to
+		 * be sent before the file.
+		 */
+		queue::size_type position;
+	};
+
+	std::deque<file_transfer> file_transfers;
+
+	/** Files that have been read into the send queue when compression
+	 * has been enabled. file_progress_event is emitted for them in
+	 * order with the packets received before.
+	 */
+	std::deque<file_transfer> inlined_files;
+
+	/** A packet sent with a token for which packet_sent_event has not
+	 * yet been emitted.
+	 */
+	struct pending_send
+	{
+		unsigned long token;
+
+		/** Offset behind the packet in all data queued into
+		 * sendqueue, including files, or in all data written to the
+		 * socket if <em>on_wire</em> is set. The latter is the case
+		 * when the packet has been moved to wirequeue or into a
+		 * zero-copy segment.
+		 */
+		uint64_t end;
+		bool on_wire;
+	};
+
+	std::deque<pending_send> pending_sends;
+
+	/** A packet in a priority queue.
+	 */
+	struct scheduled_packet
+	{
+		queue::size_type size;
+		unsigned long queued_at;
+
+		bool has_token;
+		unsigned long token;
+	};
+
+	/** Packets of one priority that have not yet been moved to
+	 * sendqueue.
+	 */
+	struct priority_queue
+	{
+		queue data;
+		std::deque<scheduled_packet> packets;
+
+		unsigned int weight;
+		queue::size_type deficit;
+	};
+
+	priority_queue priorities[PRIORITY_BULK + 1];
+	unsigned int current_priority;
+	unsigned long max_starvation;
+
+	/** Amount of data that left sendqueue, and that has been written
+	 * to the socket.
+	 */
+	uint64_t sendqueue_removed;
+	uint64_t wire_sent;
+
+	std::deque<zerocopy_segment> zerocopy_segments;
+	zerocopy_state zerocopy;
+	queue::size_type zerocopy_threshold;
+	unsigned long zerocopy_sends;
+	unsigned long zerocopy_completed;
+
+	signal_connected_type signal_connected;
+	signal_connect_failed_type signal_connect_failed;
 	signal_recv_type signal_recv;
 	signal_send_type signal_send;
+	signal_packet_sent_type signal_packet_sent;
 	signal_close_type signal_close;
 	signal_encrypted_type signal_encrypted;
 	signal_encryption_failed_type signal_encryption_failed;
+	signal_compressed_type signal_compressed;
+	signal_compression_failed_type signal_compression_failed;
+	signal_frame_too_large_type signal_frame_too_large;
+	signal_param_chunk_type signal_param_chunk;
+	signal_file_progress_type signal_file_progress;
 
-	std::auto_ptr<tcp_client_socket> remote_sock;
+	std::unique_ptr<tcp_client_socket> remote_sock;
 	tcp_encrypted_socket_base* encrypted_sock;
-	std::auto_ptr<address> remote_addr;
+	std::unique_ptr<address> remote_addr;
 
 	conn_state state;
 	keepalive_state keepalive;
+
+	/** Whether TCP_USER_TIMEOUT has been set for KEEPALIVE_KERNEL,
+	 * it is left alone if it has been configured otherwise.
+	 */
+	bool keepalive_user_timeout;
+
+	compression_state compression;
+
+	unsigned int cork_count;
+	bool sock_corked;
 	dh_params* params;
 
+	std::unique_ptr<deflate_stream> zstream;
+
+	token_bucket recv_limit;
+	token_bucket send_limit;
+	token_bucket* shared_recv_limit;
+	token_bucket* shared_send_limit;
+
+	/** Directions that are not selected because the rate limit has
+	 * been exceeded, and when to select them again.
+	 */
+	io_condition throttled;
+	unsigned long throttle_deadline;
+
+	/** When the keepalive timer elapses, zero if it is not running.
+	 */
+	unsigned long keepalive_deadline;
+
+	/** Whether the connection is closed by close_after_flush(), and
+	 * when it is closed at the latest, zero if there is no limit.
+	 */
+	flush_state flush;
+	unsigned long flush_deadline;
+
+	connection_stats stats;
+
+	/** Since when outgoing data waits for the socket to become
+	 * writable, zero if it does not.
+	 */
+	unsigned long outgoing_since;
+
+	queue::size_type max_frame_size;
+	queue::size_type stream_threshold;
+
+	/** Amount of data to read from the socket next time.
+	 */
+	queue::size_type recv_size;
+	queue::size_type max_recv_size;
+
+	/** Amount of data at the beginning of recvqueue that is known not
+	 * to contain a complete packet.
+	 */
+	queue::size_type recv_scanned;
+
+	/** Parameters of the packet that is currently streamed, NULL if
+	 * no packet is being streamed.
+	 */
+	std::shared_ptr<const packet> stream_header;
+	unsigned int stream_index;
+
+	/** Whether the streamed packet is a file whose body is received
+	 * verbatim, and how much of it is still missing.
+	 */
+	bool stream_raw;
+	queue::size_type stream_remaining;
+
 private:
+	friend class packet_writer;
+
 	void setup_signal();
+	void select_outgoing();
+	bool has_outgoing_data() const;
+
+	void move_pending_sends(queue::size_type len);
+	void add_pending_send(unsigned long token);
+
+	void enqueue(const packet& pack);
+	void enqueue_unblocked(const packet& pack);
+	void enqueue(const packet& pack,
+	             send_priority priority,
+	             bool has_token,
+	             unsigned long token);
+
+	bool has_scheduled_data() const;
+	void schedule();
+	void schedule_all(send_priority priority);
+	void schedule_packet(priority_queue& prio);
+	int next_priority();
+
+	bool begin_zerocopy(queue& outqueue);
+	bool has_zerocopy_data() const;
+	void release_zerocopy();
+	void orphan_zerocopy();
+
 	void init_impl();
+	void init_stats();
+	void reset();
 
 	void on_sock_event(io_condition io);
 	void do_io(io_condition io);
+	void handle_io_error(error::code code);
+
+	void finish_connect();
+	void check_flushed();
 
 	void begin_handshake(tcp_encrypted_socket_base* sock);
 	void do_recv(const packet& pack);
 	void do_handshake();
 
+	void begin_compression();
+	bool inflate_received();
+
+	bool begin_stream();
+	bool begin_file(const packet& pack);
+	void inline_files();
+	bool stream_received(std::string& data, chunk_position& position);
+
 	void start_keepalive_timer();
 	void stop_keepalive_timer();
+	void set_kernel_keepalive(bool enable);
+	void update_timer();
+
+	queue::size_type get_allowance(io_condition cond);
+	void consume_tokens(io_condition cond, queue::size_type amount);
 
 	void net_encryption(const packet& pack);
 	void net_encryption_ok(const packet& pack);
 	void net_encryption_failed(const packet& pack);
 	void net_encryption_begin(const packet& pack);
+	void net_compression(const packet& pack);
+	void net_compression_ok(const packet& pack);
+	void net_compression_failed(const packet& pack);
 	void net_ping(const packet& pack);
 };
 
+/** @brief Corks a connection for the lifetime of this object.
+ */
+class scoped_cork: private non_copyable
+{
+public:
+	scoped_cork(connection_base& conn);
+	~scoped_cork();
+
+private:
+	connection_base& conn;
+};
+
 /** @brief Connection to another host.
  */
 template<typename Selector>
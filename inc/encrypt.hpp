@@ -93,22 +93,33 @@ public:
 	/** @brief Tries to send <em>len</em> bytes of data starting at
 	 * <em>buf</em>.
 	 *
-	 * The function returns the amount of bytes actually sent that may
-	 * be less than <em>len</em>.
+	 * The amount of bytes actually sent, that may be less than
+	 * <em>len</em>, is stored in <em>sent</em>. send() calls this
+	 * function as well.
 	 *
 	 * A handshake must have been performed before using this function.
 	 */
-	virtual size_type send(const void* buf, size_type len) const;
+	virtual error::code try_send(const void* buf,
+	                             size_type len,
+	                             size_type& sent) const;
 
 	/** @brief Tries to read <em>len</em> bytes of data into the buffer
 	 * starting at <em>buf</em>.
 	 *
-	 * The function returns the amount of bytes actually read that may
-	 * be less than <em>len</em>.
+	 * The amount of bytes actually read, that may be less than
+	 * <em>len</em>, is stored in <em>received</em>. recv() calls
+	 * this function as well.
 	 *
 	 * A handshake must have been performed before using this function.
 	 */
-	virtual size_type recv(void* buf, size_type len) const;
+	virtual error::code try_recv(void* buf,
+	                             size_type len,
+	                             size_type& received) const;
+
+	/** @brief Closes the TLS session for sending before shutting down
+	 * the socket for sending.
+	 */
+	virtual void shutdown_send() const;
 
 protected:
 	/** Ownership of session is given to tcp_encrypted_socket_base.
@@ -152,7 +163,7 @@ private:
 	typedef gnutls_anon_server_credentials_t credentials_type;
 	credentials_type anoncred;
 
-	std::auto_ptr<dh_params> own_params;
+	std::unique_ptr<dh_params> own_params;
 };
 
 } // namespace net6
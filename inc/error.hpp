@@ -139,7 +139,9 @@ public:
 		UNEXPECTED_PACKET,
 		UNEXPECTED_PACKET_LENGTH,
 
-		UNKNOWN // This is a nonrecoverable error
+		UNKNOWN, // This is a nonrecoverable error
+
+		NONE // No error occured
 	};
 
 	/** Generate error by an error code from a system function call.
@@ -158,6 +160,19 @@ public:
 	 */
 	code get_code() const;
 
+	/** @brief Translates an error code from a system function call to a
+	 * net6 error code without generating an error.
+	 *
+	 * This is cheaper than constructing an error because the error
+	 * message is not looked up.
+	 */
+	static code translate(domain error_domain, int error_code);
+
+	/** @brief Translates the last occured error of the given domain to a
+	 * net6 error code without generating an error.
+	 */
+	static code translate(domain error_domain);
+
 private:
 	code errcode;
 };
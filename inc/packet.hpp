@@ -23,6 +23,7 @@
 #include <vector>
 #include <sstream>
 #include <stdexcept>
+#include <type_traits>
 #include "serialise.hpp"
 #include "queue.hpp"
 
@@ -64,6 +65,7 @@ public:
 	/** Uses the given string as serialised parameter data.
 	 */
 	parameter(const std::string& value);
+	parameter(std::string&& value);
 
 	/** Serialises the object of <em>data_type</em> and serialises it
 	 * through <em>ctx</em> as parameter value.
@@ -77,11 +79,21 @@ public:
 	 */
 	const std::string& serialised() const;
 
+	/** Deserialises the parameter value with the hexadecimal context.
+	 */
+	template<typename data_type>
+	data_type as() const;
+
 	/** Deserialises the parameter value with the given context.
 	 */
 	template<typename data_type>
-	data_type as(const serialise::context_base_from<data_type>& ctx =
-	             serialise::hex_context_from<data_type>()) const;
+	data_type as(const serialise::context_base_from<data_type>& ctx) const;
+
+	/** Deserialises the parameter value with the compile-time context
+	 * <em>context_type</em>, see serialise::static_context.
+	 */
+	template<typename data_type, typename context_type>
+	data_type as() const;
 
 protected:
 	serialise::data m_value;
@@ -94,6 +106,25 @@ parameter::parameter(const data_type& type,
 {
 }
 
+template<typename data_type>
+data_type parameter::as() const
+{
+	return as<data_type, serialise::hex_ctx>();
+}
+
+template<typename data_type, typename context_type>
+data_type parameter::as() const
+{
+	try
+	{
+		return m_value.as<data_type, context_type>();
+	}
+	catch(serialise::conversion_error& e)
+	{
+		throw bad_format(e.what() );
+	}
+}
+
 template<typename data_type>
 data_type parameter::
 	as(const serialise::context_base_from<data_type>& ctx) const
@@ -142,12 +173,24 @@ public:
 	 */
 	packet(queue& queue);
 
-	/** Adds a new parameter to the packet.
+	/** Adds a new parameter to the packet using the hexadecimal context.
+	 */
+	template<typename data_type>
+	void add_param(const data_type& value);
+
+	/** Adds a new parameter that is serialised through <em>ctx</em>.
 	 */
 	template<typename data_type>
 	void add_param(const data_type& value,
-	               const serialise::context_base_to<data_type>& ctx =
-	               serialise::hex_context_to<data_type>() );
+	               const serialise::context_base_to<data_type>& ctx);
+
+	/** Adds a new parameter that is serialised through the compile-time
+	 * context <em>context_type</em>, see serialise::static_context.
+	 */
+	template<typename context_type, typename data_type>
+	typename std::enable_if<
+		serialise::is_static_context<context_type>::value
+	>::type add_param(const data_type& value);
 
 	/** Shortcut for add_param(T)
 	 */
@@ -159,6 +202,9 @@ public:
 	const std::string& get_command() const;
 
 	/** Returns the <em>index</em>d parameter of this packet.
+	 *
+	 * Parameters of a packet read from a queue are split and unescaped
+	 * on first access, so fields that are never read cost nothing.
 	 */
 	const parameter& get_param(unsigned int index) const;
 
@@ -172,17 +218,76 @@ public:
 	 */
 	void enqueue(queue& queue) const;
 protected:
+	friend class packet_writer;
+	friend class connection_base;
+	template<typename... types> friend class packet_type;
+	template<typename data_type> friend struct packet_field;
+
 	static std::string escape(const std::string& string);
 	static std::string unescape(const std::string& string);
+	static std::string unescape(const char* begin, const char* end);
+
+	/** Appends the escaped form of <em>len</em> bytes starting at
+	 * <em>data</em> to <em>queue</em>.
+	 */
+	static void escape(queue& queue,
+	                   const char* data,
+	                   queue::size_type len);
+
+	/** Builds the parameter index of a packet that has been read from
+	 * a queue, if this has not already been done.
+	 */
+	void index_params() const;
+
+	/** Stores the text of the <em>index</em>ed parameter in [begin, end)
+	 * without creating a parameter object. Returns whether the text is
+	 * still escaped. The index is not checked.
+	 */
+	bool raw_param(unsigned int index,
+	               const char*& begin,
+	               const char*& end) const;
 
 	std::string command;
-	std::vector<parameter> params;
+	mutable std::vector<parameter> params;
+
+	/** Escaped representation of a packet read from a queue, without
+	 * the trailing newline.
+	 */
+	std::string frame;
+
+	/** Offsets of the escaped parameters within frame. The last entry
+	 * points one past the end of the frame.
+	 */
+	mutable std::vector<std::string::size_type> fields;
+
+	/** Whether the corresponding entry in params has already been
+	 * unescaped from frame.
+	 */
+	mutable std::vector<bool> decoded;
+
+	mutable bool indexed;
 };
 
+template<typename data_type>
+void packet::add_param(const data_type& value)
+{
+	add_param<serialise::hex_ctx>(value);
+}
+
+template<typename context_type, typename data_type>
+typename std::enable_if<
+	serialise::is_static_context<context_type>::value
+>::type packet::add_param(const data_type& value)
+{
+	index_params();
+	params.push_back(parameter(context_type::to_string(value) ) );
+}
+
 template<typename data_type>
 void packet::add_param(const data_type& value,
                        const serialise::context_base_to<data_type>& ctx)
 {
+	index_params();
 	params.push_back(parameter(value, ctx) );
 }
 
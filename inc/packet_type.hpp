@@ -0,0 +1,263 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef _NET6_PACKET_TYPE_HPP_
+#define _NET6_PACKET_TYPE_HPP_
+
+#include <string>
+#include <tuple>
+#include "serialise.hpp"
+#include "packet.hpp"
+#include "packet_writer.hpp"
+#include "connection.hpp"
+
+namespace net6
+{
+
+/** Decodes a single field of a packet_type from the text of a packet
+ * parameter in [begin, end). <em>escaped</em> tells whether the text still
+ * has to be unescaped.
+ *
+ * The generic version goes through serialise::hex_ctx, strings
+ * and numbers are decoded directly without creating any intermediate
+ * objects. Specialise this template to decode other types
+ * directly.
+ */
+template<typename data_type>
+struct packet_field
+{
+	static data_type decode(const char* begin,
+	                        const char* end,
+	                        bool escaped);
+};
+
+template<>
+struct packet_field<std::string>
+{
+	static std::string decode(const char* begin,
+	                          const char* end,
+	                          bool escaped);
+};
+
+/** Numbers are decoded by serialise::numeric in base 16, like
+ * serialise::hex_context_from does.
+ */
+template<typename data_type>
+struct packet_field_numeric
+{
+	static data_type decode(const char* begin, const char* end, bool)
+	{
+		try
+		{
+			return serialise::numeric<data_type>::from_string(
+				begin,
+				end,
+				16
+			);
+		}
+		catch(serialise::conversion_error& e)
+		{
+			throw bad_format(e.what() );
+		}
+	}
+};
+
+template<> struct packet_field<int>:
+	packet_field_numeric<int> {};
+template<> struct packet_field<unsigned int>:
+	packet_field_numeric<unsigned int> {};
+template<> struct packet_field<long>:
+	packet_field_numeric<long> {};
+template<> struct packet_field<unsigned long>:
+	packet_field_numeric<unsigned long> {};
+template<> struct packet_field<short>:
+	packet_field_numeric<short> {};
+template<> struct packet_field<unsigned short>:
+	packet_field_numeric<unsigned short> {};
+template<> struct packet_field<float>:
+	packet_field_numeric<float> {};
+template<> struct packet_field<double>:
+	packet_field_numeric<double> {};
+template<> struct packet_field<long double>:
+	packet_field_numeric<long double> {};
+template<> struct packet_field<bool>:
+	packet_field_numeric<bool> {};
+
+/** List of parameter indices of a packet_type, used to decode all fields
+ * in one expression.
+ */
+template<unsigned int... indices> struct packet_type_indices {};
+
+template<unsigned int count, unsigned int... indices>
+struct packet_type_make_indices:
+	packet_type_make_indices<count - 1, count - 1, indices...> {};
+
+template<unsigned int... indices>
+struct packet_type_make_indices<0, indices...>
+{
+	typedef packet_type_indices<indices...> type;
+};
+
+/** Describes the layout of a packet: its command and the types of its
+ * parameters.
+ *
+ * Packets are encoded from and decoded to the field values in one go.
+ * Calling encode() or send() with the wrong number of fields does not
+ * compile, the parameter count of a received packet is checked only once
+ * and every field is decoded by a packet_field that is chosen at compile
+ * time, without going through the virtual serialisation contexts.
+ *
+ * @code
+ * static const packet_type<unsigned int, std::string> join("join");
+ * join.send(conn, id, name);
+ *
+ * unsigned int id; std::string name;
+ * std::tie(id, name) = join.decode(pack);
+ * @endcode
+ */
+template<typename... types>
+class packet_type
+{
+public:
+	typedef std::tuple<types...> value_type;
+
+	enum { arity = sizeof...(types) };
+
+	packet_type(const std::string& command);
+
+	/** Returns the command of packets of this type.
+	 */
+	const std::string& get_command() const;
+
+	/** Creates a packet of this type. It may be extended with further
+	 * parameters before it is sent.
+	 */
+	packet encode(const types&... fields) const;
+
+	/** Writes a packet of this type directly into the send queue of
+	 * <em>conn</em>, see packet_writer.
+	 */
+	void send(connection_base& conn, const types&... fields) const;
+
+	/** Decodes the fields of <em>pack</em>. The packet may carry more
+	 * parameters than this type describes, these are ignored. bad_count
+	 * is thrown if it carries less, bad_format if a field could not be
+	 * decoded.
+	 */
+	static value_type decode(const packet& pack);
+
+protected:
+	template<unsigned int... indices>
+	static value_type decode(const packet& pack,
+	                         packet_type_indices<indices...>);
+
+	template<typename data_type>
+	static data_type field(const packet& pack, unsigned int index);
+
+	std::string command;
+};
+
+template<typename data_type>
+data_type packet_field<data_type>::
+	decode(const char* begin, const char* end, bool escaped)
+{
+	try
+	{
+		return serialise::hex_ctx::from_string<data_type>(
+			packet_field<std::string>::decode(begin, end, escaped)
+		);
+	}
+	catch(serialise::conversion_error& e)
+	{
+		// Same error as parameter::as would throw
+		throw bad_format(e.what() );
+	}
+}
+
+template<typename... types>
+packet_type<types...>::packet_type(const std::string& command):
+	command(command)
+{
+}
+
+template<typename... types>
+const std::string& packet_type<types...>::get_command() const
+{
+	return command;
+}
+
+template<typename... types>
+packet packet_type<types...>::encode(const types&... fields) const
+{
+	packet pack(command, arity);
+
+	// Braced initialisation appends the fields in order
+	int expand[] = { 0, ( (void)(pack << fields), 0)... };
+	(void)expand;
+
+	return pack;
+}
+
+template<typename... types>
+void packet_type<types...>::send(connection_base& conn,
+                                 const types&... fields) const
+{
+	packet_writer writer(conn, command);
+
+	int expand[] = { 0, ( (void)(writer << fields), 0)... };
+	(void)expand;
+
+	writer.commit();
+}
+
+template<typename... types>
+typename packet_type<types...>::value_type
+packet_type<types...>::decode(const packet& pack)
+{
+	if(pack.get_param_count() < static_cast<unsigned int>(arity) )
+		throw bad_count();
+
+	return decode(
+		pack,
+		typename packet_type_make_indices<sizeof...(types)>::type()
+	);
+}
+
+template<typename... types>
+template<unsigned int... indices>
+typename packet_type<types...>::value_type
+packet_type<types...>::decode(const packet& pack,
+                              packet_type_indices<indices...>)
+{
+	return value_type(field<types>(pack, indices)...);
+}
+
+template<typename... types>
+template<typename data_type>
+data_type packet_type<types...>::field(const packet& pack, unsigned int index)
+{
+	const char* begin;
+	const char* end;
+	bool escaped = pack.raw_param(index, begin, end);
+	return packet_field<data_type>::decode(begin, end, escaped);
+}
+
+} // namespace net6
+
+#endif // _NET6_PACKET_TYPE_HPP_
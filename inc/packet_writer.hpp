@@ -0,0 +1,148 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _NET6_PACKET_WRITER_HPP_
+#define _NET6_PACKET_WRITER_HPP_
+
+#include <string>
+#include <type_traits>
+#include "non_copyable.hpp"
+#include "serialise.hpp"
+#include "queue.hpp"
+#include "packet.hpp"
+#include "connection.hpp"
+
+namespace net6
+{
+
+/** Builds a packet directly in the send queue of a connection.
+ *
+ * Parameters are serialised with the same hexadecimal contexts that
+ * packet::add_param uses by default and escaped straight into the send
+ * queue, so sending a packet that only consists of strings and integers
+ * does not require any heap allocation. Other parameters are serialised
+ * into one buffer that is reused for all parameters of the packet. The packet is only sent when
+ * commit() is called; if the writer is destroyed before, the partially
+ * written packet is removed from the queue again.
+ *
+ * No other packet may be sent on the connection while a packet_writer
+ * for it exists.
+ */
+class packet_writer: private non_copyable
+{
+public:
+	/** Starts a new packet with the given command on <em>conn</em>.
+	 * @param size_hint Expected size of the whole packet. Memory for
+	 * this many bytes is reserved in the send queue at once.
+	 */
+	packet_writer(connection_base& conn,
+	              const char* command,
+	              queue::size_type size_hint = 0);
+
+	packet_writer(connection_base& conn,
+	              const std::string& command,
+	              queue::size_type size_hint = 0);
+
+	~packet_writer();
+
+	/** Adds a parameter that is serialised through <em>ctx</em>.
+	 */
+	template<typename data_type>
+	packet_writer& add_param(const data_type& value,
+	                         const serialise::context_base_to<data_type>&
+	                         ctx);
+
+	/** Adds a parameter that is serialised through the compile-time
+	 * context <em>context_type</em>, see serialise::static_context.
+	 */
+	template<typename context_type, typename data_type>
+	typename std::enable_if<
+		serialise::is_static_context<context_type>::value,
+		packet_writer&
+	>::type add_param(const data_type& value);
+
+	/** Adds a parameter using the default hexadecimal context.
+	 */
+	template<typename data_type>
+	packet_writer& operator<<(const data_type& value);
+
+	packet_writer& operator<<(const std::string& value);
+	packet_writer& operator<<(const char* value);
+	packet_writer& operator<<(bool value);
+	packet_writer& operator<<(int value);
+	packet_writer& operator<<(unsigned int value);
+	packet_writer& operator<<(long value);
+	packet_writer& operator<<(unsigned long value);
+	packet_writer& operator<<(short value);
+	packet_writer& operator<<(unsigned short value);
+
+	/** Terminates the packet and queues it for sending.
+	 */
+	void commit();
+
+protected:
+	void begin(const char* command,
+	           queue::size_type len,
+	           queue::size_type size_hint);
+
+	void add_raw(const char* data, queue::size_type len);
+	void add_hex(unsigned long value);
+
+	connection_base& conn;
+	queue& sendqueue;
+
+	/** Serialised form of the parameter that is currently added.
+	 */
+	std::string buffer;
+
+	queue::size_type begin_pos;
+	bool committed;
+};
+
+template<typename data_type>
+packet_writer& packet_writer::
+	add_param(const data_type& value,
+	          const serialise::context_base_to<data_type>& ctx)
+{
+	buffer.clear();
+	ctx.append_to(buffer, value);
+	add_raw(buffer.data(), buffer.length() );
+	return *this;
+}
+
+template<typename context_type, typename data_type>
+typename std::enable_if<
+	serialise::is_static_context<context_type>::value,
+	packet_writer&
+>::type packet_writer::add_param(const data_type& value)
+{
+	buffer.clear();
+	context_type::append_to(buffer, value);
+	add_raw(buffer.data(), buffer.length() );
+	return *this;
+}
+
+template<typename data_type>
+packet_writer& packet_writer::operator<<(const data_type& value)
+{
+	return add_param<serialise::hex_ctx>(value);
+}
+
+} // namespace net6
+
+#endif // _NET6_PACKET_WRITER_HPP_
@@ -44,9 +44,16 @@ public:
 	 */
 	size_type get_size() const;
 
-	/** Returns the size of the next packet in the queue.
+	/** Returns the size of the queue including data behind the block
+	 * position.
 	 */
-	size_type packet_size() const;
+	size_type get_total_size() const;
+
+	/** Returns the size of the next packet in the queue. The search
+	 * starts at <em>from</em>, so data that is known not to contain the
+	 * end of a packet need not be scanned again.
+	 */
+	size_type packet_size(size_type from = 0) const;
 
 	/** Returns a pointer to the data that is currently enqueued.
 	 */
@@ -60,12 +67,43 @@ public:
 	 */
 	void prepend(const char* new_data, size_type len);
 
+	/** Inserts data in front of the block position, so that it is not
+	 * held back. Without a block, this is the same as append().
+	 */
+	void append_unblocked(const char* new_data, size_type len);
+
 	/** Removes data from the queue.
 	 */
 	void remove(size_type len);
 
+	/** Makes sure that <em>len</em> more bytes can be appended to the
+	 * queue without reallocating. Returns the free space behind the
+	 * data, which may be written to directly and then be added to the
+	 * queue by commit().
+	 */
+	char* reserve(size_type len);
+
+	/** Appends <em>len</em> bytes that have been written into the space
+	 * returned by reserve().
+	 */
+	void commit(size_type len);
+
+	/** Removes data from the end of the queue so that <em>len</em> bytes
+	 * remain.
+	 */
+	void truncate(size_type len);
+
+	/** Exchanges the contents of two queues without copying them.
+	 */
+	void swap(queue& other);
+
 	void block();
 	void unblock();
+
+	/** @brief Returns whether data behind a block position is held
+	 * back.
+	 */
+	bool is_blocked() const;
 private:
 	char* data;
 	size_type size;
@@ -20,6 +20,7 @@
 #define _NET6_SELECT_HPP_
 
 #include <map>
+#include <set>
 #include "non_copyable.hpp"
 #include "default_accumulator.hpp"
 #include "socket.hpp"
@@ -37,9 +38,37 @@ class selector
 public:
 	typedef sigc::signal<void, const socket&, io_condition> signal_io_type;
 
+	/** @brief Determines when data is sent that has been queued while
+	 * the selector dispatched events.
+	 */
+	enum flush_policy {
+		/** Sockets that have been selected for IO_OUTGOING while
+		 * dispatching are handled by the next call to select().
+		 */
+		FLUSH_NEXT_SELECT,
+
+		/** Sockets that have been selected for IO_OUTGOING while
+		 * dispatching get their IO_OUTGOING event once all other
+		 * events have been dispatched, if they are writable. Data
+		 * queued by multiple handlers is thus flushed once at the end
+		 * of each iteration.
+		 */
+		FLUSH_END_OF_ITERATION
+	};
+
+	selector();
+
 	// Virtual destructor makes the compiler happy
 	virtual ~selector() {}
 
+	/** @brief Sets the flush policy. The default is FLUSH_NEXT_SELECT.
+	 */
+	void set_flush_policy(flush_policy policy);
+
+	/** @brief Returns the current flush policy.
+	 */
+	flush_policy get_flush_policy() const;
+
 	/** @brief Gets all conditions currently set on a socket
 	 *
 	 * The function can be used to retrieve the conditions
@@ -119,9 +148,18 @@ protected:
 	typedef std::map<const socket*, selected_type> map_type;
 
 	void select_impl(timeval* tv);
+	void flush_impl();
 
 	map_type sock_map;
 	bool running;
+
+	flush_policy policy;
+	bool dispatching;
+
+	/** Sockets that have been selected for IO_OUTGOING while
+	 * dispatching events.
+	 */
+	std::set<const socket*> flush_set;
 };
 
 }
@@ -0,0 +1,383 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef _NET6_SEQUENCE_HPP_
+#define _NET6_SEQUENCE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "serialise.hpp"
+#include "binary.hpp"
+
+namespace serialise
+{
+
+/** @brief Text encoding of sequences of built-in numbers.
+ *
+ * The elements are converted by serialise::numeric and separated by a
+ * single space. The whole sequence is converted in one pass over a
+ * buffer on the stack, no stream is involved.
+ */
+template<typename data_type>
+struct sequence_text
+{
+	static_assert(
+		is_numeric<data_type>::value,
+		"Sequence elements must be built-in numbers"
+	);
+
+	/** Appends the elements in [begin, end) to <em>to</em>.
+	 */
+	template<typename iterator>
+	static void append(std::string& to,
+	                   iterator begin,
+	                   iterator end,
+	                   unsigned int base)
+	{
+		char buf[numeric<data_type>::max_length + 1];
+		buf[0] = ' ';
+
+		// No separator in front of the first element
+		char* text_begin = buf + 1;
+		for(; begin != end; ++ begin)
+		{
+			to.append(
+				text_begin,
+				numeric<data_type>::write(buf + 1, *begin, base)
+			);
+
+			text_begin = buf;
+		}
+	}
+
+	/** Returns the number of elements in <em>from</em>.
+	 */
+	static std::size_t count(const std::string& from)
+	{
+		if(from.empty() ) return 0;
+		return std::count(from.begin(), from.end(), ' ') + 1;
+	}
+
+	/** Converts the elements in <em>from</em> and calls <em>func</em>
+	 * for each of them.
+	 */
+	template<typename function_type>
+	static void read(const std::string& from,
+	                 unsigned int base,
+	                 function_type func)
+	{
+		const char* pos = from.data();
+		const char* end = pos + from.length();
+		if(pos == end) return;
+
+		for(;;)
+		{
+			const char* sep = static_cast<const char*>(
+				std::memchr(pos, ' ', end - pos)
+			);
+
+			if(sep == NULL) sep = end;
+			func(numeric<data_type>::from_string(pos, sep, base) );
+
+			if(sep == end) return;
+			pos = sep + 1;
+		}
+	}
+};
+
+template<typename data_type, typename allocator_type>
+void read_sequence(const std::string& from,
+                   unsigned int base,
+                   std::vector<data_type, allocator_type>& to)
+{
+	to.reserve(sequence_text<data_type>::count(from) );
+	sequence_text<data_type>::read(
+		from,
+		base,
+		[&to](const data_type& value) { to.push_back(value); }
+	);
+}
+
+template<typename data_type, std::size_t N>
+void read_sequence(const std::string& from,
+                   unsigned int base,
+                   std::array<data_type, N>& to)
+{
+	if(sequence_text<data_type>::count(from) != N)
+	{
+		throw conversion_error(
+			"Could not convert \"" + from + "\" to " +
+			type_name<data_type>::name + " array: wrong number of "
+			"elements"
+		);
+	}
+
+	typename std::array<data_type, N>::iterator iter = to.begin();
+	sequence_text<data_type>::read(
+		from,
+		base,
+		[&iter](const data_type& value) { *(iter ++) = value; }
+	);
+}
+
+/** Context that converts a sequence of built-in numbers in the given
+ * base. default_context_to and hex_context_to are specialised for
+ * std::vector and std::array to use it.
+ */
+template<typename sequence_type>
+class sequence_context_to: public context_base_to<sequence_type>
+{
+public:
+	typedef typename sequence_type::value_type value_type;
+
+	sequence_context_to(unsigned int base):
+		m_base(base) {}
+
+	virtual std::string to_string(const sequence_type& from) const
+	{
+		std::string result;
+		append_to(result, from);
+		return result;
+	}
+
+	virtual void append_to(std::string& to,
+	                       const sequence_type& from) const
+	{
+		sequence_text<value_type>::append(
+			to, from.begin(), from.end(), m_base
+		);
+	}
+
+protected:
+	unsigned int m_base;
+};
+
+/** Context that converts a string back to a sequence of built-in
+ * numbers. A std::array is only accepted with exactly as many elements
+ * as it has.
+ */
+template<typename sequence_type>
+class sequence_context_from: public context_base_from<sequence_type>
+{
+public:
+	sequence_context_from(unsigned int base):
+		m_base(base) {}
+
+	virtual sequence_type from_string(const std::string& from) const
+	{
+		sequence_type result;
+		read_sequence(from, m_base, result);
+		return result;
+	}
+
+protected:
+	unsigned int m_base;
+};
+
+template<typename data_type, typename allocator_type>
+class default_context_to<std::vector<data_type, allocator_type> >:
+	public sequence_context_to<std::vector<data_type, allocator_type> >
+{
+public:
+	default_context_to():
+		sequence_context_to<std::vector<data_type, allocator_type> >(
+			10
+		) {}
+};
+
+template<typename data_type, typename allocator_type>
+class default_context_from<std::vector<data_type, allocator_type> >:
+	public sequence_context_from<std::vector<data_type, allocator_type> >
+{
+public:
+	default_context_from():
+		sequence_context_from<std::vector<data_type, allocator_type> >(
+			10
+		) {}
+};
+
+template<typename data_type, typename allocator_type>
+class hex_context_to<std::vector<data_type, allocator_type> >:
+	public sequence_context_to<std::vector<data_type, allocator_type> >
+{
+public:
+	hex_context_to():
+		sequence_context_to<std::vector<data_type, allocator_type> >(
+			16
+		) {}
+};
+
+template<typename data_type, typename allocator_type>
+class hex_context_from<std::vector<data_type, allocator_type> >:
+	public sequence_context_from<std::vector<data_type, allocator_type> >
+{
+public:
+	hex_context_from():
+		sequence_context_from<std::vector<data_type, allocator_type> >(
+			16
+		) {}
+};
+
+template<typename data_type, std::size_t N>
+class default_context_to<std::array<data_type, N> >:
+	public sequence_context_to<std::array<data_type, N> >
+{
+public:
+	default_context_to():
+		sequence_context_to<std::array<data_type, N> >(10) {}
+};
+
+template<typename data_type, std::size_t N>
+class default_context_from<std::array<data_type, N> >:
+	public sequence_context_from<std::array<data_type, N> >
+{
+public:
+	default_context_from():
+		sequence_context_from<std::array<data_type, N> >(10) {}
+};
+
+template<typename data_type, std::size_t N>
+class hex_context_to<std::array<data_type, N> >:
+	public sequence_context_to<std::array<data_type, N> >
+{
+public:
+	hex_context_to():
+		sequence_context_to<std::array<data_type, N> >(16) {}
+};
+
+template<typename data_type, std::size_t N>
+class hex_context_from<std::array<data_type, N> >:
+	public sequence_context_from<std::array<data_type, N> >
+{
+public:
+	hex_context_from():
+		sequence_context_from<std::array<data_type, N> >(16) {}
+};
+
+/** Binary encoding shared by std::vector and std::array. The elements
+ * are appended one after another with serialise::binary, a vector is
+ * prefixed by its size.
+ */
+template<typename sequence_type>
+struct binary_sequence
+{
+	typedef typename sequence_type::value_type value_type;
+	static const bool is_binary = true;
+
+	static void append_elements(std::string& to, const sequence_type& from)
+	{
+		typename sequence_type::const_iterator iter;
+		for(iter = from.begin(); iter != from.end(); ++ iter)
+			binary<value_type>::append(to, *iter);
+	}
+
+	static void append_to(std::string& to, const sequence_type& from)
+	{
+		binary<sequence_type>::append(to, from);
+	}
+
+	static std::string to_string(const sequence_type& from)
+	{
+		std::string result;
+		append_to(result, from);
+		return result;
+	}
+
+	static sequence_type from_string(const std::string& from)
+	{
+		const char* begin = from.data();
+		const char* end = begin + from.length();
+
+		sequence_type result = binary<sequence_type>::read(begin, end);
+		if(begin != end)
+		{
+			throw conversion_error(
+				std::string("Could not decode binary ") +
+				type_name<value_type>::name +
+				" sequence: trailing data"
+			);
+		}
+
+		return result;
+	}
+};
+
+template<typename data_type, typename allocator_type>
+struct binary<std::vector<data_type, allocator_type> >:
+	binary_sequence<std::vector<data_type, allocator_type> >
+{
+	typedef std::vector<data_type, allocator_type> sequence_type;
+
+	static void append(std::string& to, const sequence_type& from)
+	{
+		binary<unsigned long>::append(to, from.size() );
+		binary_sequence<sequence_type>::append_elements(to, from);
+	}
+
+	static sequence_type read(const char*& begin, const char* end)
+	{
+		unsigned long size = binary<unsigned long>::read(begin, end);
+
+		// Each element takes at least one byte, so do not trust a
+		// size that cannot possibly be right.
+		if(size > static_cast<unsigned long>(end - begin) )
+		{
+			throw conversion_error(
+				std::string("Could not decode binary ") +
+				type_name<data_type>::name +
+				" sequence: truncated"
+			);
+		}
+
+		sequence_type result;
+		result.reserve(size);
+		for(unsigned long i = 0; i < size; ++ i)
+			result.push_back(binary<data_type>::read(begin, end) );
+
+		return result;
+	}
+};
+
+template<typename data_type, std::size_t N>
+struct binary<std::array<data_type, N> >:
+	binary_sequence<std::array<data_type, N> >
+{
+	typedef std::array<data_type, N> sequence_type;
+
+	static void append(std::string& to, const sequence_type& from)
+	{
+		binary_sequence<sequence_type>::append_elements(to, from);
+	}
+
+	static sequence_type read(const char*& begin, const char* end)
+	{
+		sequence_type result;
+		for(std::size_t i = 0; i < N; ++ i)
+			result[i] = binary<data_type>::read(begin, end);
+
+		return result;
+	}
+};
+
+} // namespace serialise
+
+#endif // _NET6_SEQUENCE_HPP_
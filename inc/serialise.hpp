@@ -19,9 +19,11 @@
 #ifndef _NET6_SERIALISE_HPP_
 #define _NET6_SERIALISE_HPP_
 
+#include <limits>
 #include <string>
 #include <sstream>
 #include <stdexcept>
+#include <type_traits>
 
 /** Generic stuff to de/serialise data types to/from strings.
  */
@@ -54,6 +56,111 @@ template<> struct type_name<double> { static const char* name; };
 template<> struct type_name<long double> { static const char* name; };
 template<> struct type_name<bool> { static const char* name; };
 
+/** @brief Conversion of built-in numbers without a stream.
+ *
+ * The default and hexadecimal contexts use this for integer, bool and
+ * floating point types. Integers are written in the given base, where
+ * negative numbers are written as their unsigned counterpart in base 16,
+ * as std::ostream does. Floating point numbers are always written in
+ * decimal notation with the precision a default std::ostream uses, and
+ * always with a '.' as decimal point regardless of the C locale.
+ *
+ * from_string accepts exactly what to_string produces, additionally a
+ * leading '-' for signed integers in base 16 and uppercase hexadecimal
+ * digits. It throws conversion_error if the text is not a number or if
+ * the number is out of range.
+ */
+template<typename data_type>
+struct numeric
+{
+	static const bool is_numeric = false;
+};
+
+/** Conversion functions shared by all numeric specialisations. They are
+ * instantiated in the library for the types numeric is specialised for.
+ */
+template<typename data_type>
+struct numeric_conversion
+{
+	static const bool is_numeric = true;
+
+	/** Maximum amount of characters write() produces.
+	 */
+	static const std::size_t max_length =
+		std::numeric_limits<unsigned long>::digits + 2;
+
+	/** Writes <em>from</em> to <em>buf</em>, which must have room for
+	 * max_length characters, and returns the end of the written text.
+	 * The text is not NUL-terminated.
+	 */
+	static char* write(char* buf, data_type from, unsigned int base);
+
+	static std::string to_string(data_type from, unsigned int base);
+
+	/** Appends <em>from</em> to <em>to</em>.
+	 */
+	static void append_to(std::string& to,
+	                      data_type from,
+	                      unsigned int base)
+	{
+		char buf[max_length];
+		to.append(buf, write(buf, from, base) );
+	}
+
+	static data_type from_string(const char* begin,
+	                             const char* end,
+	                             unsigned int base);
+
+	static data_type from_string(const std::string& from,
+	                             unsigned int base)
+	{
+		return from_string(
+			from.data(),
+			from.data() + from.length(),
+			base
+		);
+	}
+};
+
+template<> struct numeric<int>: numeric_conversion<int> {};
+template<> struct numeric<long>: numeric_conversion<long> {};
+template<> struct numeric<short>: numeric_conversion<short> {};
+template<> struct numeric<unsigned int>:
+	numeric_conversion<unsigned int> {};
+template<> struct numeric<unsigned long>:
+	numeric_conversion<unsigned long> {};
+template<> struct numeric<unsigned short>:
+	numeric_conversion<unsigned short> {};
+template<> struct numeric<float>: numeric_conversion<float> {};
+template<> struct numeric<double>: numeric_conversion<double> {};
+template<> struct numeric<long double>:
+	numeric_conversion<long double> {};
+template<> struct numeric<bool>: numeric_conversion<bool> {};
+
+/** std::true_type if serialise::numeric can convert <em>data_type</em>,
+ * std::false_type otherwise.
+ */
+template<typename data_type>
+struct is_numeric:
+	std::integral_constant<bool, numeric<data_type>::is_numeric> {};
+
+/** @brief Decides whether a default or hexadecimal context converts
+ * built-in numbers without a stream.
+ *
+ * It is a virtual base, so only the constructor of the most-derived
+ * class initialises it. default_context_to, default_context_from and
+ * the hex contexts enable the numeric path, classes derived from them
+ * leave it disabled, so their on_stream_setup is called for numbers as
+ * well. Unlike a check of the dynamic type, this works without RTTI.
+ */
+class numeric_path
+{
+protected:
+	numeric_path(bool enable = false): use_numeric(enable) {}
+
+	bool use_numeric;
+};
+
 /** Abstract base context type to convert something to a string.
  */
 template<typename data_type>
@@ -65,6 +172,19 @@ public:
 	/** @brief Converts the given data type to a string.
 	 */
 	virtual std::string to_string(const data_type& from) const = 0;
+
+	/** @brief Appends the serialised form of <em>from</em> to
+	 * <em>to</em>.
+	 *
+	 * Contexts override this to write into the existing buffer
+	 * instead of creating a temporary string, so a caller may reuse
+	 * one buffer for many values. A derived context that changes
+	 * to_string must change append_to accordingly.
+	 */
+	virtual void append_to(std::string& to, const data_type& from) const
+	{
+		to += to_string(from);
+	}
 };
 
 /** Abstract base context type to convert a string to another type.
@@ -82,27 +202,55 @@ public:
 };
 
 /** Default context to convert something literally to a string.
+ *
+ * Built-in numeric types are converted by serialise::numeric, all other
+ * types are written to a std::stringstream.
  */
 template<typename data_type>
-class default_context_to: public context_base_to<data_type>
+class default_context_to: public context_base_to<data_type>,
+                          protected virtual numeric_path
 {
 public:
+	default_context_to(): numeric_path(true) {}
+
 	/** @brief Converts the given data type to a string.
 	 */
 	virtual std::string to_string(const data_type& from) const;
 
+	virtual void append_to(std::string& to, const data_type& from) const;
+
 protected:
 	/** Method derived classes may overload to alter the conversion.
+	 * default_context_to itself converts built-in numeric types without
+	 * a stream, derived contexts always use one.
 	 */
 	virtual void on_stream_setup(std::stringstream& stream) const;
+
+	std::string to_string_impl(const data_type& from,
+	                           std::true_type) const;
+	std::string to_string_impl(const data_type& from,
+	                           std::false_type) const;
+
+	void append_to_impl(std::string& to,
+	                    const data_type& from,
+	                    std::true_type) const;
+	void append_to_impl(std::string& to,
+	                    const data_type& from,
+	                    std::false_type) const;
 };
 
 /** Default context to convert a string literally to a type.
+ *
+ * Built-in numeric types are converted by serialise::numeric, all other
+ * types are read from a std::stringstream.
  */
 template<typename data_type>
-class default_context_from: public context_base_from<data_type>
+class default_context_from: public context_base_from<data_type>,
+                            protected virtual numeric_path
 {
 public:
+	default_context_from(): numeric_path(true) {}
+
 	/** @brief Converts the given string to the type specified
 	 * as template parameter.
 	 *
@@ -112,26 +260,64 @@ public:
 
 protected:
 	/** Method derived classes may overload to alter the conversion.
+	 * default_context_from itself converts built-in numeric types
+	 * without a stream, derived contexts always use one.
 	 */
 	virtual void on_stream_setup(std::stringstream& stream) const;
+
+	data_type from_string_impl(const std::string& from,
+	                           std::true_type) const;
+	data_type from_string_impl(const std::string& from,
+	                           std::false_type) const;
 };
 
 /** Context that uses hexadecimal representation for numerical types.
  */
 template<typename data_type>
-class hex_context_to: public default_context_to<data_type>
+class hex_context_to: public default_context_to<data_type>,
+                      protected virtual numeric_path
 {
+public:
+	hex_context_to(): numeric_path(true) {}
+
+	virtual std::string to_string(const data_type& from) const;
+
+	virtual void append_to(std::string& to, const data_type& from) const;
+
 protected:
 	virtual void on_stream_setup(std::stringstream& stream) const;
+
+	std::string hex_to_string(const data_type& from,
+	                          std::true_type) const;
+	std::string hex_to_string(const data_type& from,
+	                          std::false_type) const;
+
+	void hex_append_to(std::string& to,
+	                   const data_type& from,
+	                   std::true_type) const;
+	void hex_append_to(std::string& to,
+	                   const data_type& from,
+	                   std::false_type) const;
 };
 
 /** Context that uses hexadecimal representation for numerical types.
  */
 template<typename data_type>
-class hex_context_from: public default_context_from<data_type>
+class hex_context_from: public default_context_from<data_type>,
+                        protected virtual numeric_path
 {
 public:
+	hex_context_from(): numeric_path(true) {}
+
+	virtual data_type from_string(const std::string& from) const;
+
 	virtual void on_stream_setup(std::stringstream& stream) const;
+
+protected:
+	data_type hex_from_string(const std::string& from,
+	                          std::true_type) const;
+	data_type hex_from_string(const std::string& from,
+	                          std::false_type) const;
 };
 
 template<>
@@ -141,6 +327,7 @@ public:
 	typedef std::string data_type;
 
 	virtual std::string to_string(const data_type& from) const;
+	virtual void append_to(std::string& to, const data_type& from) const;
 };
 
 template<>
@@ -159,6 +346,7 @@ public:
 	typedef const char* data_type;
 
 	virtual std::string to_string(const data_type& from) const;
+	virtual void append_to(std::string& to, const data_type& from) const;
 };
 
 template<std::size_t N>
@@ -168,8 +356,60 @@ public:
 	typedef char data_type[N];
 
 	virtual std::string to_string(const data_type& from) const;
+	virtual void append_to(std::string& to, const data_type& from) const;
 };
 
+/** @brief Base class of contexts that are chosen at compile time.
+ *
+ * Such a context provides static to_string, append_to and from_string
+ * function templates instead of virtual functions, so conversions through it can
+ * be inlined completely. Pass it as template parameter, for example
+ * packet::add_param<serialise::hex_ctx>(value) or
+ * parameter::as<int, serialise::hex_ctx>().
+ */
+struct static_context {};
+
+/** @brief Compile-time counterpart of default_context_to and
+ * default_context_from.
+ *
+ * Built-in numeric types are converted by serialise::numeric, other
+ * types by default_context_to and default_context_from, so custom
+ * types keep working through their context specialisations.
+ */
+struct default_ctx: public static_context
+{
+	template<typename data_type>
+	static std::string to_string(const data_type& from);
+
+	template<typename data_type>
+	static void append_to(std::string& to, const data_type& from);
+
+	template<typename data_type>
+	static data_type from_string(const std::string& from);
+};
+
+/** @brief Compile-time counterpart of hex_context_to and
+ * hex_context_from.
+ */
+struct hex_ctx: public static_context
+{
+	template<typename data_type>
+	static std::string to_string(const data_type& from);
+
+	template<typename data_type>
+	static void append_to(std::string& to, const data_type& from);
+
+	template<typename data_type>
+	static data_type from_string(const std::string& from);
+};
+
+/** std::true_type if <em>context_type</em> is a compile-time context,
+ * std::false_type otherwise.
+ */
+template<typename context_type>
+struct is_static_context:
+	std::is_base_of<static_context, context_type> {};
+
 #if 0
 /** String serialisation does not need any conversions.
  */
@@ -228,6 +468,7 @@ public:
 	/** Uses the given string as serialised data without converting it.
 	 */
 	data(const std::string& serialised);
+	data(std::string&& serialised);
 
 	/** Serialises the given object with the given context. A default
 	 * context is used if no one is given.
@@ -240,6 +481,10 @@ public:
 	 */
 	const std::string& serialised() const;
 
+	/** Appends the serialised data to <em>to</em>.
+	 */
+	void append_to(std::string& to) const;
+
 	/** Deserialises the object with the given context. A default context
 	 * is used of no one is given.
 	 */
@@ -247,6 +492,12 @@ public:
 	type as(const context_base_from<type>& ctx =
 		default_context_from<type>()) const;
 
+	/** Deserialises the object with the compile-time context
+	 * <em>context_type</em>.
+	 */
+	template<typename type, typename context_type>
+	type as() const;
+
 protected:
 	std::string m_serialised;
 };
@@ -254,6 +505,24 @@ protected:
 template<typename data_type>
 std::string default_context_to<data_type>::
 	to_string(const data_type& from) const
+{
+	// Derived contexts may alter the conversion in on_stream_setup
+	if(!this->use_numeric)
+		return to_string_impl(from, std::false_type() );
+
+	return to_string_impl(from, is_numeric<data_type>() );
+}
+
+template<typename data_type>
+std::string default_context_to<data_type>::
+	to_string_impl(const data_type& from, std::true_type) const
+{
+	return numeric<data_type>::to_string(from, 10);
+}
+
+template<typename data_type>
+std::string default_context_to<data_type>::
+	to_string_impl(const data_type& from, std::false_type) const
 {
 	std::stringstream stream;
 	on_stream_setup(stream);
@@ -261,9 +530,55 @@ std::string default_context_to<data_type>::
 	return stream.str();
 }
 
+template<typename data_type>
+void default_context_to<data_type>::
+	append_to(std::string& to, const data_type& from) const
+{
+	if(!this->use_numeric)
+		append_to_impl(to, from, std::false_type() );
+	else
+		append_to_impl(to, from, is_numeric<data_type>() );
+}
+
+template<typename data_type>
+void default_context_to<data_type>::
+	append_to_impl(std::string& to,
+	               const data_type& from,
+	               std::true_type) const
+{
+	numeric<data_type>::append_to(to, from, 10);
+}
+
+template<typename data_type>
+void default_context_to<data_type>::
+	append_to_impl(std::string& to,
+	               const data_type& from,
+	               std::false_type) const
+{
+	to += this->to_string(from);
+}
+
 template<typename data_type>
 data_type default_context_from<data_type>::
 	from_string(const std::string& from) const
+{
+	// Derived contexts may alter the conversion in on_stream_setup
+	if(!this->use_numeric)
+		return from_string_impl(from, std::false_type() );
+
+	return from_string_impl(from, is_numeric<data_type>() );
+}
+
+template<typename data_type>
+data_type default_context_from<data_type>::
+	from_string_impl(const std::string& from, std::true_type) const
+{
+	return numeric<data_type>::from_string(from, 10);
+}
+
+template<typename data_type>
+data_type default_context_from<data_type>::
+	from_string_impl(const std::string& from, std::false_type) const
 {
 	std::stringstream stream(from);
 	on_stream_setup(stream);
@@ -293,6 +608,82 @@ void default_context_from<data_type>::
 {
 }
 
+template<typename data_type>
+std::string hex_context_to<data_type>::
+	to_string(const data_type& from) const
+{
+	if(!this->use_numeric)
+		return default_context_to<data_type>::to_string(from);
+
+	return hex_to_string(from, is_numeric<data_type>() );
+}
+
+template<typename data_type>
+std::string hex_context_to<data_type>::
+	hex_to_string(const data_type& from, std::true_type) const
+{
+	return numeric<data_type>::to_string(from, 16);
+}
+
+template<typename data_type>
+std::string hex_context_to<data_type>::
+	hex_to_string(const data_type& from, std::false_type) const
+{
+	return default_context_to<data_type>::to_string(from);
+}
+
+template<typename data_type>
+void hex_context_to<data_type>::
+	append_to(std::string& to, const data_type& from) const
+{
+	if(!this->use_numeric)
+		default_context_to<data_type>::append_to(to, from);
+	else
+		hex_append_to(to, from, is_numeric<data_type>() );
+}
+
+template<typename data_type>
+void hex_context_to<data_type>::
+	hex_append_to(std::string& to,
+	              const data_type& from,
+	              std::true_type) const
+{
+	numeric<data_type>::append_to(to, from, 16);
+}
+
+template<typename data_type>
+void hex_context_to<data_type>::
+	hex_append_to(std::string& to,
+	              const data_type& from,
+	              std::false_type) const
+{
+	default_context_to<data_type>::append_to(to, from);
+}
+
+template<typename data_type>
+data_type hex_context_from<data_type>::
+	from_string(const std::string& from) const
+{
+	if(!this->use_numeric)
+		return default_context_from<data_type>::from_string(from);
+
+	return hex_from_string(from, is_numeric<data_type>() );
+}
+
+template<typename data_type>
+data_type hex_context_from<data_type>::
+	hex_from_string(const std::string& from, std::true_type) const
+{
+	return numeric<data_type>::from_string(from, 16);
+}
+
+template<typename data_type>
+data_type hex_context_from<data_type>::
+	hex_from_string(const std::string& from, std::false_type) const
+{
+	return default_context_from<data_type>::from_string(from);
+}
+
 template<typename data_type>
 void hex_context_to<data_type>::
 	on_stream_setup(std::stringstream& stream) const
@@ -319,6 +710,113 @@ data_type data::as(const context_base_from<data_type>& ctx) const
 	return ctx.from_string(m_serialised);
 }
 
+template<typename type, typename context_type>
+type data::as() const
+{
+	return context_type::template from_string<type>(m_serialised);
+}
+
+/** Converts a built-in number in <em>base</em> or uses the context
+ * template <em>context_to</em> for any other type.
+ */
+template<typename data_type, template<typename> class context_to>
+inline std::string static_to_string(const data_type& from,
+                                    unsigned int base,
+                                    std::true_type)
+{
+	return numeric<data_type>::to_string(from, base);
+}
+
+template<typename data_type, template<typename> class context_to>
+inline std::string static_to_string(const data_type& from,
+                                    unsigned int,
+                                    std::false_type)
+{
+	return context_to<data_type>().to_string(from);
+}
+
+template<typename data_type, template<typename> class context_to>
+inline void static_append_to(std::string& to,
+                             const data_type& from,
+                             unsigned int base,
+                             std::true_type)
+{
+	numeric<data_type>::append_to(to, from, base);
+}
+
+template<typename data_type, template<typename> class context_to>
+inline void static_append_to(std::string& to,
+                             const data_type& from,
+                             unsigned int,
+                             std::false_type)
+{
+	context_to<data_type>().append_to(to, from);
+}
+
+template<typename data_type, template<typename> class context_from>
+inline data_type static_from_string(const std::string& from,
+                                    unsigned int base,
+                                    std::true_type)
+{
+	return numeric<data_type>::from_string(from, base);
+}
+
+template<typename data_type, template<typename> class context_from>
+inline data_type static_from_string(const std::string& from,
+                                    unsigned int,
+                                    std::false_type)
+{
+	return context_from<data_type>().from_string(from);
+}
+
+template<typename data_type>
+std::string default_ctx::to_string(const data_type& from)
+{
+	return static_to_string<data_type, default_context_to>(
+		from, 10, is_numeric<data_type>()
+	);
+}
+
+template<typename data_type>
+void default_ctx::append_to(std::string& to, const data_type& from)
+{
+	static_append_to<data_type, default_context_to>(
+		to, from, 10, is_numeric<data_type>()
+	);
+}
+
+template<typename data_type>
+data_type default_ctx::from_string(const std::string& from)
+{
+	return static_from_string<data_type, default_context_from>(
+		from, 10, is_numeric<data_type>()
+	);
+}
+
+template<typename data_type>
+std::string hex_ctx::to_string(const data_type& from)
+{
+	return static_to_string<data_type, hex_context_to>(
+		from, 16, is_numeric<data_type>()
+	);
+}
+
+template<typename data_type>
+void hex_ctx::append_to(std::string& to, const data_type& from)
+{
+	static_append_to<data_type, hex_context_to>(
+		to, from, 16, is_numeric<data_type>()
+	);
+}
+
+template<typename data_type>
+data_type hex_ctx::from_string(const std::string& from)
+{
+	return static_from_string<data_type, hex_context_from>(
+		from, 16, is_numeric<data_type>()
+	);
+}
+
 template<size_t N>
 std::string default_context_to<char[N]>::
 	to_string(const data_type& from) const
@@ -326,6 +824,13 @@ std::string default_context_to<char[N]>::
 	return from;
 }
 
+template<size_t N>
+void default_context_to<char[N]>::
+	append_to(std::string& to, const data_type& from) const
+{
+	to += from;
+}
+
 } // namespace serialise
 
 #endif // _NET6_SERIALISE_HPP_
@@ -20,6 +20,7 @@
 #define _NET6_SERVER_HPP_
 
 #include <memory>
+#include <utility>
 #include <sigc++/signal.h>
 #include <sigc++/bind.h>
 
@@ -116,7 +117,9 @@ public:
 	 */
 	void kick(const user& user);
 
-	/** Send a packet to all the connected and logged in users.
+	/** Send a packet to all the connected and logged in users. Users
+	 * whose connection is being closed by close_after_flush() are
+	 * skipped.
 	 */
 	virtual void send(const packet& pack);
 
@@ -128,11 +131,98 @@ public:
 	 */
 	virtual void request_encryption(const user& to);
 
+	/** @brief Requests compressed communication with the given user.
+	 */
+	virtual void request_compression(const user& to);
+
 	/** Returns the underlaying TCP server socket object. The function
 	 * throws not_connected_error if the server has not been opened.
 	 */
 	const tcp_server_socket& get_socket() const;
 
+	/** @brief Sets the options that are applied to every accepted
+	 * client socket.
+	 *
+	 * Already established connections are not affected. The buffer
+	 * sizes are set on the server sockets, so that accepted sockets
+	 * inherit them from the start. By default,
+	 * only TCP_NODELAY is enabled since net6 sends small packets that
+	 * should not wait for acknowledgements of previous ones.
+	 */
+	void set_socket_options(const tcp_options& options);
+
+	/** @brief Returns the options that are applied to every accepted
+	 * client socket.
+	 */
+	const tcp_options& get_socket_options() const;
+
+	/** @brief Sets the maximum number of connections that may wait for
+	 * being accepted.
+	 *
+	 * The new value is used the next time the server is (re)opened.
+	 * The default is SOMAXCONN.
+	 */
+	void set_listen_backlog(int backlog);
+
+	/** @brief Returns the listen backlog of the server sockets.
+	 */
+	int get_listen_backlog() const;
+
+	/** @brief Limits the rate at which data is received from all
+	 * clients together, in bytes per second. Zero removes the limit.
+	 *
+	 * See connection_base::set_recv_rate.
+	 */
+	void set_recv_rate(queue::size_type rate, queue::size_type burst = 0);
+
+	/** @brief Returns the receive rate of all clients together, or zero
+	 * if it is not limited.
+	 */
+	queue::size_type get_recv_rate() const;
+
+	/** @brief Limits the rate at which data is sent to all clients
+	 * together, in bytes per second. Zero removes the limit.
+	 */
+	void set_send_rate(queue::size_type rate, queue::size_type burst = 0);
+
+	/** @brief Returns the send rate of all clients together, or zero if
+	 * it is not limited.
+	 */
+	queue::size_type get_send_rate() const;
+
+	/** @brief Limits the rate at which data is received from a single
+	 * client. Zero removes the limit.
+	 *
+	 * Only applies to clients that connect afterwards.
+	 */
+	void set_client_recv_rate(queue::size_type rate,
+	                          queue::size_type burst = 0);
+
+	/** @brief Returns the receive rate of a single client, or zero if it
+	 * is not limited.
+	 */
+	queue::size_type get_client_recv_rate() const;
+
+	/** @brief Limits the rate at which data is sent to a single client.
+	 * Zero removes the limit.
+	 *
+	 * Only applies to clients that connect afterwards.
+	 */
+	void set_client_send_rate(queue::size_type rate,
+	                          queue::size_type burst = 0);
+
+	/** @brief Returns the send rate of a single client, or zero if it is
+	 * not limited.
+	 */
+	queue::size_type get_client_send_rate() const;
+
+	/** @brief Returns the traffic counters of all clients together,
+	 * including those that have already disconnected.
+	 *
+	 * Use user::get_stats() to find out about a single client.
+	 */
+	connection_stats get_stats() const;
+
 	/** Signal which is emitted when a new connection has been accepted.
 	 * The signal handler may return an ID for the new client. Be sure that
 	 * the ID is not already in use. If the signal handler returns the
@@ -221,11 +311,29 @@ protected:
 
 	virtual void net_client_login(user& from, const packet& pack);
 
-	std::auto_ptr<tcp_server_socket> serv_sock;
-	std::auto_ptr<tcp_server_socket> serv6_sock;
+	std::unique_ptr<tcp_server_socket> serv_sock;
+	std::unique_ptr<tcp_server_socket> serv6_sock;
 
 	bool use_ipv6;
 
+	tcp_options sock_options;
+	int listen_backlog;
+
+	/** Shared by all connections
+	 */
+	token_bucket recv_limit;
+	token_bucket send_limit;
+
+	/** Rates for every single connection, the buckets themselves are
+	 * not used.
+	 */
+	token_bucket client_recv_limit;
+	token_bucket client_send_limit;
+
+	/** Counters of clients that have been removed
+	 */
+	connection_stats removed_stats;
+
 	dh_params params;
 
 	signal_connect_type signal_connect;
@@ -240,20 +348,23 @@ protected:
 private:
 	void shutdown_impl();
 	void reopen_impl(unsigned int port, bool use_ipv6);
+	void apply_socket_options(tcp_client_socket& sock) const;
 };
 
 typedef basic_server<selector> server;
 
 template<typename selector_type>
 basic_server<selector_type>::basic_server(bool ipv6)
- : use_ipv6(ipv6)
+ : use_ipv6(ipv6), listen_backlog(SOMAXCONN)
 {
+	sock_options.nodelay = true;
 }
 
 template<typename selector_type>
 basic_server<selector_type>::basic_server(unsigned int port, bool ipv6)
- : use_ipv6(ipv6)
+ : use_ipv6(ipv6), listen_backlog(SOMAXCONN)
 {
+	sock_options.nodelay = true;
 	reopen_impl(port, ipv6);
 }
 
@@ -297,8 +408,12 @@ void basic_server<selector_type>::send(const packet& pack)
 	    i != basic_object<selector_type>::users.end();
 	    ++ i)
 	{
-		if(i->second->is_logged_in() )
+		// No more packets may be sent to closing connections
+		if(i->second->is_logged_in() &&
+		   !i->second->get_connection().is_flushing() )
+		{
 			send(pack, *i->second);
+		}
 	}
 }
 
@@ -315,6 +430,12 @@ void basic_server<selector_type>::request_encryption(const user& to)
 	to.request_encryption();
 }
 
+template<typename selector_type>
+void basic_server<selector_type>::request_compression(const user& to)
+{
+	to.request_compression();
+}
+
 template<typename selector_type>
 const tcp_server_socket& basic_server<selector_type>::get_socket() const
 {
@@ -324,6 +445,109 @@ const tcp_server_socket& basic_server<selector_type>::get_socket() const
 	return *serv_sock;
 }
 
+template<typename selector_type>
+void basic_server<selector_type>::set_socket_options(const tcp_options& options)
+{
+	sock_options = options;
+
+	// Connections accepted from now on inherit the buffer sizes
+	tcp_server_socket* socks[] = { serv_sock.get(), serv6_sock.get() };
+	for(unsigned int i = 0; i < 2; ++ i)
+	{
+		if(socks[i] == NULL) continue;
+
+		if(options.send_buffer > 0)
+			socks[i]->set_send_buffer(options.send_buffer);
+		if(options.receive_buffer > 0)
+			socks[i]->set_receive_buffer(options.receive_buffer);
+	}
+}
+
+template<typename selector_type>
+const tcp_options& basic_server<selector_type>::get_socket_options() const
+{
+	return sock_options;
+}
+
+template<typename selector_type>
+void basic_server<selector_type>::set_listen_backlog(int backlog)
+{
+	listen_backlog = backlog;
+}
+
+template<typename selector_type>
+int basic_server<selector_type>::get_listen_backlog() const
+{
+	return listen_backlog;
+}
+
+template<typename selector_type>
+void basic_server<selector_type>::set_recv_rate(queue::size_type rate,
+                                                queue::size_type burst)
+{
+	recv_limit.set_rate(rate, burst);
+}
+
+template<typename selector_type>
+queue::size_type basic_server<selector_type>::get_recv_rate() const
+{
+	return recv_limit.get_rate();
+}
+
+template<typename selector_type>
+void basic_server<selector_type>::set_send_rate(queue::size_type rate,
+                                                queue::size_type burst)
+{
+	send_limit.set_rate(rate, burst);
+}
+
+template<typename selector_type>
+queue::size_type basic_server<selector_type>::get_send_rate() const
+{
+	return send_limit.get_rate();
+}
+
+template<typename selector_type>
+void basic_server<selector_type>::
+	set_client_recv_rate(queue::size_type rate, queue::size_type burst)
+{
+	client_recv_limit.set_rate(rate, burst);
+}
+
+template<typename selector_type>
+queue::size_type basic_server<selector_type>::get_client_recv_rate() const
+{
+	return client_recv_limit.get_rate();
+}
+
+template<typename selector_type>
+void basic_server<selector_type>::
+	set_client_send_rate(queue::size_type rate, queue::size_type burst)
+{
+	client_send_limit.set_rate(rate, burst);
+}
+
+template<typename selector_type>
+queue::size_type basic_server<selector_type>::get_client_send_rate() const
+{
+	return client_send_limit.get_rate();
+}
+
+template<typename selector_type>
+connection_stats basic_server<selector_type>::get_stats() const
+{
+	connection_stats result(removed_stats);
+	for(typename basic_object<selector_type>::user_const_iterator iter =
+		this->users.begin();
+	    iter != this->users.end();
+	    ++ iter)
+	{
+		result += iter->second->get_stats();
+	}
+
+	return result;
+}
+
 template<typename selector_type>
 typename basic_server<selector_type>::signal_connect_type
 basic_server<selector_type>::connect_event() const
@@ -388,6 +612,12 @@ void basic_server<selector_type>::remove_client(const user* user)
 		on_part(*user);
 	on_disconnect(*user);
 
+	// Keep the traffic of the client in the server counters, but do
+	// not count its connection as established any longer.
+	connection_stats stats = user->get_stats();
+	stats.connections = stats.encrypted = stats.compressed = 0;
+	removed_stats += stats;
+
 	// Store ID of client to remove
 	unsigned int user_id = user->is_logged_in() ? user->get_id() : 0;
 	// Remove user to prevent server from sending the packet to the
@@ -419,7 +649,7 @@ void basic_server<selector_type>::on_accept_event(tcp_server_socket& sock,
 	// Get selector from base class
 	selector_type& selector = basic_object<selector_type>::get_selector();
 	connection_type* conn = new connection_type(selector);
-	std::auto_ptr<user> client(new user(last_id + 1, conn) );
+	std::unique_ptr<user> client(new user(last_id + 1, conn) );
 
 	conn->recv_event().connect(
 		sigc::bind(
@@ -444,17 +674,37 @@ void basic_server<selector_type>::on_accept_event(tcp_server_socket& sock,
 
 	conn->set_dh_params(params);
 
+	conn->set_shared_recv_limit(&recv_limit);
+	conn->set_shared_send_limit(&send_limit);
+	if(client_recv_limit.get_rate() > 0)
+	{
+		conn->set_recv_rate(
+			client_recv_limit.get_rate(),
+			client_recv_limit.get_burst()
+		);
+	}
+
+	if(client_send_limit.get_rate() > 0)
+	{
+		conn->set_send_rate(
+			client_send_limit.get_rate(),
+			client_send_limit.get_burst()
+		);
+	}
+
 	if(&sock == serv_sock.get())
 	{
 		ipv4_address addr;
-		std::auto_ptr<tcp_client_socket> new_sock(sock.accept(addr));
-		conn->assign(new_sock, addr);
+		std::unique_ptr<tcp_client_socket> new_sock(sock.accept(addr));
+		apply_socket_options(*new_sock);
+		conn->assign(std::move(new_sock), addr);
 	}
 	else if(&sock == serv6_sock.get())
 	{
 		ipv6_address addr;
-		std::auto_ptr<tcp_client_socket> new_sock(sock.accept(addr));
-		conn->assign(new_sock, addr);
+		std::unique_ptr<tcp_client_socket> new_sock(sock.accept(addr));
+		apply_socket_options(*new_sock);
+		conn->assign(std::move(new_sock), addr);
 	}
 	else
 	{
@@ -646,16 +896,28 @@ void basic_server<selector_type>::shutdown_impl()
 	if(serv_sock.get() != NULL)
 	{
 		selector.set(*serv_sock, IO_NONE);
-		serv_sock.reset(NULL);
+		serv_sock.reset();
 	}
 
 	if(serv6_sock.get() != NULL)
 	{
 		selector.set(*serv6_sock, IO_NONE);
-		serv6_sock.reset(NULL);
+		serv6_sock.reset();
 	}
 }
 
+template<typename selector_type>
+void basic_server<selector_type>::
+	apply_socket_options(tcp_client_socket& sock) const
+{
+	// The buffer sizes have been set on the server sockets already,
+	// accepted sockets inherit them.
+	tcp_options options(sock_options);
+	options.send_buffer = 0;
+	options.receive_buffer = 0;
+	options.apply(sock);
+}
+
 template<typename selector_type>
 void basic_server<selector_type>::reopen_impl(unsigned int port, bool ipv6)
 {
@@ -665,7 +927,13 @@ void basic_server<selector_type>::reopen_impl(unsigned int port, bool ipv6)
 	if(ipv6)
 	{
 		ipv6_address bind_addr(port);
-		serv6_sock.reset(new tcp_server_socket(bind_addr) );
+		serv6_sock.reset(
+			new tcp_server_socket(
+				bind_addr,
+				listen_backlog,
+				sock_options
+			)
+		);
 
 		selector.set(*serv6_sock,
 			selector.get(*serv6_sock) | IO_INCOMING
@@ -687,7 +955,13 @@ void basic_server<selector_type>::reopen_impl(unsigned int port, bool ipv6)
 	try
 	{
 		ipv4_address bind_addr(port);
-		serv_sock.reset(new tcp_server_socket(bind_addr) );
+		serv_sock.reset(
+			new tcp_server_socket(
+				bind_addr,
+				listen_backlog,
+				sock_options
+			)
+		);
 
 		selector.set(*serv_sock,
 			selector.get(*serv_sock) | IO_INCOMING
@@ -41,6 +41,8 @@ enum io_condition
 
 NET6_DEFINE_ENUM_OPS(io_condition)
 
+class tcp_options;
+
 /** Abstract socket class.
  */
 class socket: private non_copyable
@@ -86,6 +88,28 @@ private:
  */
 class tcp_socket: public socket
 {
+public:
+	/** @brief Sets the size of the kernel send buffer (SO_SNDBUF).
+	 */
+	void set_send_buffer(size_type size);
+
+	/** @brief Returns the size of the kernel send buffer.
+	 *
+	 * Linux reports twice the size that has been set since it
+	 * accounts for its bookkeeping overhead.
+	 */
+	size_type get_send_buffer() const;
+
+	/** @brief Sets the size of the kernel receive buffer (SO_RCVBUF).
+	 *
+	 * Sockets accepted by a server socket inherit its buffer sizes.
+	 */
+	void set_receive_buffer(size_type size);
+
+	/** @brief Returns the size of the kernel receive buffer.
+	 */
+	size_type get_receive_buffer() const;
+
 protected:
 	tcp_socket(const address& addr);
 	tcp_socket(socket_type c_object);
@@ -101,12 +125,29 @@ public:
 	 */
 	tcp_client_socket(const address& addr);
 
+	/** @brief Creates a new tcp socket and starts to connect to the
+	 * address addr.
+	 *
+	 * If <em>blocking</em> is false, the function returns immediately.
+	 * The socket becomes writable when the connection attempt has
+	 * finished, finish_connect() has to be called then.
+	 */
+	tcp_client_socket(const address& addr, bool blocking);
+
 	/** Wraps a C socket object. Note that the tcp_client_socket owns
 	 * the C object.
 	 */
 	tcp_client_socket(socket_type c_object);
 	virtual ~tcp_client_socket();
 
+	/** @brief Completes a connection attempt that has been started
+	 * without blocking.
+	 *
+	 * Throws net6::error if the connection could not be established.
+	 * Otherwise, the socket is put back into blocking mode.
+	 */
+	void finish_connect();
+
 	/** Sends an amount of data through the socket. Note that the call
 	 * may block if you did not select on a socket::OUT event.
 	 * @return The amount of data sent.
@@ -118,6 +159,144 @@ public:
 	 * @return The amount of data read.
 	 */
 	virtual size_type recv(void* buf, size_type len) const;
+
+	/** @brief Sends an amount of data through the socket like send(),
+	 * but returns an error code instead of throwing net6::error.
+	 *
+	 * The amount of data sent is stored in <em>sent</em> if the
+	 * function returns error::NONE. Errors that are expected on
+	 * non-blocking sockets, such as error::WOULD_BLOCK, do not cost
+	 * an exception this way.
+	 */
+	virtual error::code try_send(const void* buf,
+	                             size_type len,
+	                             size_type& sent) const;
+
+	/** @brief Receives an amount of data from the socket like recv(),
+	 * but returns an error code instead of throwing net6::error.
+	 *
+	 * The amount of data read is stored in <em>received</em> if the
+	 * function returns error::NONE.
+	 */
+	virtual error::code try_recv(void* buf,
+	                             size_type len,
+	                             size_type& received) const;
+
+	/** @brief Returns the amount of data that can be read from the
+	 * socket without blocking, as reported by FIONREAD.
+	 */
+	size_type get_available() const;
+
+	/** @brief Returns whether recv() would return without blocking,
+	 * that is whether data or the end of the stream is available.
+	 */
+	bool is_readable() const;
+
+	/** @brief Tells the remote site that no more data will be sent,
+	 * while data can still be received.
+	 */
+	virtual void shutdown_send() const;
+
+	/** @brief Allows the socket to send data without copying it into
+	 * the kernel, see send_zerocopy().
+	 *
+	 * Uses SO_ZEROCOPY on Linux. Returns false if the platform or the
+	 * socket does not support zero-copy sending.
+	 */
+	bool set_zerocopy(bool enable);
+
+	/** @brief Sends data without copying it into the kernel.
+	 *
+	 * The data must not be changed or freed until
+	 * read_zerocopy_completions() has reported this send as completed.
+	 * Returns true if the data has been sent this way, and false if it
+	 * has been copied by a regular send, for example because the
+	 * kernel could not pin more memory. The amount of data actually
+	 * sent is stored in <em>sent</em>.
+	 */
+	bool send_zerocopy(const void* buf, size_type len, size_type& sent) const;
+
+	/** @brief Reads completion notifications of zero-copy sends from
+	 * the error queue of the socket without blocking.
+	 *
+	 * Returns the number of sends that completed. The kernel reports
+	 * them in the order the sends have been made.
+	 */
+	unsigned long read_zerocopy_completions() const;
+
+	/** @brief Sends up to <em>len</em> bytes of the file <em>fd</em>
+	 * starting at <em>offset</em>.
+	 *
+	 * Uses sendfile(2) on Linux, so the data is not copied through
+	 * userspace. Other platforms read the file and send it. The file
+	 * position of <em>fd</em> is not changed. Returns the amount of
+	 * data sent, which is zero if the file ends before <em>offset</em>.
+	 * Note that sendfile(2) cannot suppress SIGPIPE, so applications
+	 * should ignore that signal.
+	 */
+	size_type send_file(int fd, off_t offset, size_type len) const;
+
+	/** @brief Disables the Nagle algorithm (TCP_NODELAY), so small
+	 * packets are sent immediately instead of waiting for outstanding
+	 * acknowledgements.
+	 *
+	 * Returns false if the socket does not support it, for example
+	 * AF_UNIX sockets.
+	 */
+	bool set_nodelay(bool enable);
+
+	/** @brief Sends acknowledgements immediately instead of delaying
+	 * them (TCP_QUICKACK).
+	 *
+	 * The kernel may fall back to delayed acknowledgements later on.
+	 * Returns false if the platform or the socket does not support it.
+	 */
+	bool set_quickack(bool enable);
+
+	/** @brief Limits the amount of data in the kernel send buffer
+	 * that has not been sent yet (TCP_NOTSENT_LOWAT).
+	 *
+	 * The socket is only reported writable when less than
+	 * <em>size</em> bytes are unsent, so more data stays in the send
+	 * queue where it can still be corked, compressed or reordered.
+	 * Returns false if the platform or the socket does not support it.
+	 */
+	bool set_notsent_lowat(size_type size);
+
+	/** @brief Closes the connection if sent data is not acknowledged
+	 * within <em>timeout</em> milliseconds (TCP_USER_TIMEOUT).
+	 *
+	 * Zero restores the system default. Returns false if the platform
+	 * or the socket does not support it.
+	 */
+	bool set_user_timeout(unsigned long timeout);
+
+	/** @brief Returns the TCP_USER_TIMEOUT in milliseconds, zero if
+	 * the system default is used or the platform does not support it.
+	 */
+	unsigned long get_user_timeout() const;
+
+	/** @brief Lets the kernel probe the remote site when the
+	 * connection is idle (SO_KEEPALIVE).
+	 *
+	 * The first probe is sent after <em>idle</em> milliseconds without
+	 * traffic, further ones every <em>interval</em> milliseconds. The
+	 * connection is closed after <em>count</em> unanswered probes.
+	 * The kernel works with whole seconds. Returns false if the
+	 * platform or the socket does not support setting these times.
+	 */
+	bool set_keepalive(bool enable,
+	                   unsigned long idle,
+	                   unsigned long interval,
+	                   unsigned int count);
+
+	/** @brief Tells the kernel to only send full segments until the
+	 * socket is uncorked again.
+	 *
+	 * Uses TCP_CORK or TCP_NOPUSH where available. Returns false if
+	 * the platform or the socket does not support corking.
+	 */
+	bool set_cork(bool enable);
 };
 
 /** TCP server socket
@@ -127,8 +306,19 @@ class tcp_server_socket: public tcp_socket
 {
 public:
 	/** Opens a new TCP server socket bound to <em>bind_addr</em>.
+	 * @param backlog Maximum number of connections that may wait for
+	 * being accepted.
+	 */
+	tcp_server_socket(const address& bind_addr, int backlog = SOMAXCONN);
+
+	/** Opens a new TCP server socket bound to <em>bind_addr</em> and
+	 * sets its buffer sizes from <em>options</em> before it starts
+	 * listening. Accepted sockets inherit them, which is the only way
+	 * for the receive buffer to affect the TCP window scale. The other
+	 * options are not used.
 	 */
-	tcp_server_socket(const address& bind_addr);
+	tcp_server_socket(const address& bind_addr, int backlog,
+	                  const tcp_options& options);
 
 	/** Wraps a C socket object. Note that the tcp_server_socket owns the
 	 * C object.
@@ -140,12 +330,12 @@ public:
 	 * indicates a connection waiting for acception.
 	 * @return A tcp_client_socket to communicate with the remote host.
 	 */
-	std::auto_ptr<tcp_client_socket> accept() const;
+	std::unique_ptr<tcp_client_socket> accept() const;
 
 	/** Accepts a new connection and stores the address of the remote host
 	 * in <em>from</em>.
 	 */
-	std::auto_ptr<tcp_client_socket> accept(address& from) const;
+	std::unique_ptr<tcp_client_socket> accept(address& from) const;
 };
 
 /** UDP socket.
@@ -201,6 +391,47 @@ public:
 	               address& from) const;
 };
 
+/** @brief Set of options that is applied to TCP client sockets, for
+ * example to every socket a server accepts.
+ *
+ * Options that keep their initial value are left at the system default.
+ * See the corresponding tcp_client_socket and tcp_socket functions for
+ * a description of the options.
+ */
+class tcp_options
+{
+public:
+	tcp_options();
+
+	/** @brief Applies the options to <em>sock</em>. Options that the
+	 * socket does not support are skipped.
+	 */
+	void apply(tcp_client_socket& sock) const;
+
+	/** TCP_NODELAY, false by default.
+	 */
+	bool nodelay;
+
+	/** TCP_QUICKACK, false by default.
+	 */
+	bool quickack;
+
+	/** SO_SNDBUF and SO_RCVBUF, zero to keep the system default.
+	 * Servers set them on their listening sockets.
+	 */
+	socket::size_type send_buffer;
+	socket::size_type receive_buffer;
+
+	/** TCP_NOTSENT_LOWAT, zero to keep the system default.
+	 */
+	socket::size_type notsent_lowat;
+
+	/** TCP_USER_TIMEOUT in milliseconds, zero to keep the system
+	 * default.
+	 */
+	unsigned long user_timeout;
+};
+
 } // namespace net6
 
 #endif // _NET6_SOCKET_HPP_
@@ -0,0 +1,93 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef _NET6_TOKEN_BUCKET_HPP_
+#define _NET6_TOKEN_BUCKET_HPP_
+
+#include <cstddef>
+#include <chrono>
+#include "non_copyable.hpp"
+
+namespace net6
+{
+
+/** @brief Limits the rate at which data is transferred.
+ *
+ * The bucket fills with <em>rate</em> tokens per second up to its burst
+ * size, and each byte transferred takes one token. A bucket may be shared
+ * by several connections to limit their combined rate.
+ */
+class token_bucket: private non_copyable
+{
+public:
+	typedef std::size_t size_type;
+
+	/** @brief Creates a bucket that does not limit the rate.
+	 */
+	token_bucket();
+
+	/** @brief Sets the rate in bytes per second, zero disables the
+	 * limit.
+	 *
+	 * <em>burst</em> is the amount of data that may be transferred at
+	 * once after a period of inactivity, zero means one second worth of
+	 * data. The bucket starts full.
+	 */
+	void set_rate(size_type rate, size_type burst = 0);
+
+	/** @brief Returns the rate in bytes per second, or zero if the rate
+	 * is not limited.
+	 */
+	size_type get_rate() const;
+
+	/** @brief Returns the burst size.
+	 */
+	size_type get_burst() const;
+
+	/** @brief Returns the amount of data that may be transferred now.
+	 */
+	size_type get_available();
+
+	/** @brief Takes <em>amount</em> tokens from the bucket.
+	 *
+	 * The bucket may go into debt if more data has been transferred
+	 * than was available, it then takes longer to refill.
+	 */
+	void consume(size_type amount);
+
+	/** @brief Returns the number of milliseconds until <em>amount</em>
+	 * tokens are available, or the whole burst if it is smaller.
+	 */
+	unsigned long get_wait_time(size_type amount);
+
+private:
+	typedef std::chrono::steady_clock clock_type;
+
+	void refill();
+
+	size_type rate;
+	size_type burst;
+
+	double tokens;
+	clock_type::time_point last_refill;
+};
+
+} // namespace net6
+
+#endif // _NET6_TOKEN_BUCKET_HPP_
@@ -92,6 +92,31 @@ public:
 	 */
 	void send(const packet& pack) const;
 
+	/** Sends a packet that is no longer needed by the caller to this
+	 * user.
+	 *
+	 * If there is no direct connection to this user available,
+	 * not_connected_error is thrown.
+	 */
+	void send(packet&& pack) const;
+
+	/** @brief Sends a packet to this user, the connection emits
+	 * packet_sent_event with <em>token</em> when it has been sent.
+	 *
+	 * If there is no direct connection to this user available,
+	 * not_connected_error is thrown.
+	 */
+	void send(const packet& pack, unsigned long token) const;
+
+	/** @brief Sends a packet with the given priority to this user, see
+	 * connection_base::send.
+	 *
+	 * If there is no direct connection to this user available,
+	 * not_connected_error is thrown.
+	 */
+	void send(const packet& pack,
+	          connection_base::send_priority priority) const;
+
 	/** @brief Requests an encryption connection to this client.
 	 *
 	 * If there is no direct connection to this user available,
@@ -99,6 +124,13 @@ public:
 	 */
 	void request_encryption() const;
 
+	/** @brief Requests compressed communication with this client.
+	 *
+	 * If there is no direct connection to this user available,
+	 * not_connected_error is thrown.
+	 */
+	void request_compression() const;
+
 	/** @brief Sets whether to send keepalives to this user.
 	 *
 	 * If there is no direct connection to this user available,
@@ -106,13 +138,37 @@ public:
 	 */
 	void set_enable_keepalives(bool enable) const;
 
+	/** @brief Sets whether and how to send keepalives to this user, see
+	 * connection_base::set_enable_keepalives.
+	 *
+	 * If there is no direct connection to this user available,
+	 * not_connected_error is thrown.
+	 */
+	void set_enable_keepalives(bool enable,
+	                           connection_base::keepalive_mode mode) const;
+
+	/** @brief Closes the connection to this user after all data queued
+	 * for it has been sent, see connection_base::close_after_flush.
+	 *
+	 * The server removes the user when the connection has been closed.
+	 * If there is no direct connection to this user available,
+	 * not_connected_error is thrown.
+	 */
+	void close_after_flush(unsigned long timeout) const;
+
+	/** @brief Returns the traffic counters of the connection to this
+	 * user. If there is no direct connection, not_connected_error is
+	 * thrown.
+	 */
+	connection_stats get_stats() const;
+
 protected:
 	void on_encryption_failed();
 
 	unsigned int id;
 	std::string name;
 	bool logged_in;
-	std::auto_ptr<connection_base> conn;
+	std::unique_ptr<connection_base> conn;
 
 	signal_encrypted_type signal_encrypted;
 	signal_encryption_failed_type signal_encryption_failed;
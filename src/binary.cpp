@@ -0,0 +1,382 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <inttypes.h>
+
+#include "binary.hpp"
+
+namespace
+{
+	const char* const DIGITS = "0123456789abcdef";
+
+	template<typename data_type>
+	serialise::conversion_error make_error(const char* reason)
+	{
+		return serialise::conversion_error(
+			std::string("Could not decode binary ") +
+			serialise::type_name<data_type>::name + ": " + reason
+		);
+	}
+
+	template<typename unsigned_type>
+	void append_varint(std::string& to, unsigned_type value)
+	{
+		char buf[std::numeric_limits<unsigned_type>::digits / 7 + 1];
+		std::size_t len = 0;
+
+		while(value >= 0x80)
+		{
+			buf[len ++] = static_cast<char>((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+
+		buf[len ++] = static_cast<char>(value);
+		to.append(buf, len);
+	}
+
+	template<typename data_type, typename unsigned_type>
+	unsigned_type read_varint(const char*& begin, const char* end)
+	{
+		const unsigned int bits = std::numeric_limits<unsigned_type>::digits;
+
+		unsigned_type value = 0;
+		for(unsigned int shift = 0; ; shift += 7)
+		{
+			if(begin == end)
+				throw make_error<data_type>("truncated");
+
+			unsigned char byte = static_cast<unsigned char>(*begin ++);
+			unsigned_type payload = byte & 0x7f;
+
+			// Bits that do not fit into the type. Shifting by the
+			// width of the type is undefined, so only the last
+			// byte that may fit partially is checked.
+			if(shift >= bits ||
+			   (bits - shift < 7 && (payload >> (bits - shift)) != 0))
+				throw make_error<data_type>("out of range");
+
+			value |= payload << shift;
+			if( (byte & 0x80) == 0)
+				return value;
+		}
+	}
+
+	// Zigzag encoding maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+	template<typename data_type>
+	void append_number(std::string& to, data_type from, std::true_type)
+	{
+		typedef typename std::make_unsigned<data_type>::type
+			unsigned_type;
+
+		unsigned_type value = static_cast<unsigned_type>(from);
+		unsigned_type sign = (from < 0) ? ~unsigned_type() : 0;
+		append_varint<unsigned_type>(
+			to,
+			static_cast<unsigned_type>( (value << 1) ^ sign)
+		);
+	}
+
+	template<typename data_type>
+	data_type read_number(const char*& begin,
+	                      const char* end,
+	                      std::true_type)
+	{
+		typedef typename std::make_unsigned<data_type>::type
+			unsigned_type;
+
+		unsigned_type value =
+			read_varint<data_type, unsigned_type>(begin, end);
+		unsigned_type sign = (value & 1) ? ~unsigned_type() : 0;
+		return static_cast<data_type>( (value >> 1) ^ sign);
+	}
+
+	template<typename data_type>
+	void append_number(std::string& to, data_type from, std::false_type)
+	{
+		append_varint<data_type>(to, from);
+	}
+
+	template<typename data_type>
+	data_type read_number(const char*& begin,
+	                      const char* end,
+	                      std::false_type)
+	{
+		return read_varint<data_type, data_type>(begin, end);
+	}
+
+	template<typename bits_type>
+	void append_bits(std::string& to, bits_type bits)
+	{
+		char buf[sizeof(bits_type)];
+		for(std::size_t i = 0; i < sizeof(bits_type); ++ i)
+		{
+			buf[i] = static_cast<char>(bits & 0xff);
+			bits >>= 8;
+		}
+
+		to.append(buf, sizeof(bits_type) );
+	}
+
+	template<typename data_type, typename bits_type>
+	bits_type read_bits(const char*& begin, const char* end)
+	{
+		if(static_cast<std::size_t>(end - begin) < sizeof(bits_type) )
+			throw make_error<data_type>("truncated");
+
+		bits_type bits = 0;
+		for(std::size_t i = sizeof(bits_type); i > 0; -- i)
+		{
+			bits <<= 8;
+			bits |= static_cast<unsigned char>(begin[i - 1]);
+		}
+
+		begin += sizeof(bits_type);
+		return bits;
+	}
+}
+
+const char* serialise::type_name<serialise::bytes>::name = "bytes";
+
+serialise::bytes::bytes()
+{
+}
+
+serialise::bytes::bytes(const std::string& data):
+	m_data(data)
+{
+}
+
+serialise::bytes::bytes(const void* data, std::size_t len):
+	m_data(static_cast<const char*>(data), len)
+{
+}
+
+const std::string& serialise::bytes::get_data() const
+{
+	return m_data;
+}
+
+std::size_t serialise::bytes::get_size() const
+{
+	return m_data.size();
+}
+
+bool serialise::bytes::operator==(const bytes& other) const
+{
+	return m_data == other.m_data;
+}
+
+bool serialise::bytes::operator!=(const bytes& other) const
+{
+	return m_data != other.m_data;
+}
+
+template<typename data_type>
+void serialise::binary_conversion<data_type>::
+	append(std::string& to, const data_type& from)
+{
+	append_number(to, from, typename std::is_signed<data_type>::type() );
+}
+
+template<typename data_type>
+data_type serialise::binary_conversion<data_type>::
+	read(const char*& begin, const char* end)
+{
+	return read_number<data_type>(
+		begin,
+		end,
+		typename std::is_signed<data_type>::type()
+	);
+}
+
+template<typename data_type>
+data_type serialise::binary_conversion<data_type>::
+	from_string(const std::string& from)
+{
+	const char* begin = from.data();
+	const char* end = begin + from.length();
+
+	data_type value = read(begin, end);
+	if(begin != end)
+		throw make_error<data_type>("trailing data");
+
+	return value;
+}
+
+namespace serialise
+{
+
+template<>
+void binary_conversion<float>::append(std::string& to, const float& from)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &from, sizeof(bits) );
+	append_bits(to, bits);
+}
+
+template<>
+float binary_conversion<float>::read(const char*& begin, const char* end)
+{
+	uint32_t bits = read_bits<float, uint32_t>(begin, end);
+	float value;
+	std::memcpy(&value, &bits, sizeof(value) );
+	return value;
+}
+
+template<>
+void binary_conversion<double>::append(std::string& to, const double& from)
+{
+	uint64_t bits;
+	std::memcpy(&bits, &from, sizeof(bits) );
+	append_bits(to, bits);
+}
+
+template<>
+double binary_conversion<double>::read(const char*& begin, const char* end)
+{
+	uint64_t bits = read_bits<double, uint64_t>(begin, end);
+	double value;
+	std::memcpy(&value, &bits, sizeof(value) );
+	return value;
+}
+
+template<>
+void binary_conversion<bool>::append(std::string& to, const bool& from)
+{
+	to += (from ? '\1' : '\0');
+}
+
+template<>
+bool binary_conversion<bool>::read(const char*& begin, const char* end)
+{
+	if(begin == end)
+		throw make_error<bool>("truncated");
+
+	char value = *begin ++;
+	if(value != '\0' && value != '\1')
+		throw make_error<bool>("not a boolean value");
+
+	return value == '\1';
+}
+
+template<>
+void binary_conversion<bytes>::append(std::string& to, const bytes& from)
+{
+	append_varint<std::size_t>(to, from.get_size() );
+	to += from.get_data();
+}
+
+template<>
+bytes binary_conversion<bytes>::read(const char*& begin, const char* end)
+{
+	std::size_t len = read_varint<bytes, std::size_t>(begin, end);
+	if(static_cast<std::size_t>(end - begin) < len)
+		throw make_error<bytes>("truncated");
+
+	bytes value(begin, len);
+	begin += len;
+	return value;
+}
+
+template<>
+void binary_conversion<bytes>::append_to(std::string& to, const bytes& from)
+{
+	to += from.get_data();
+}
+
+template<>
+bytes binary_conversion<bytes>::from_string(const std::string& from)
+{
+	return bytes(from);
+}
+
+} // namespace serialise
+
+template struct serialise::binary_conversion<int>;
+template struct serialise::binary_conversion<long>;
+template struct serialise::binary_conversion<short>;
+template struct serialise::binary_conversion<unsigned int>;
+template struct serialise::binary_conversion<unsigned long>;
+template struct serialise::binary_conversion<unsigned short>;
+template struct serialise::binary_conversion<float>;
+template struct serialise::binary_conversion<double>;
+template struct serialise::binary_conversion<bool>;
+template struct serialise::binary_conversion<serialise::bytes>;
+
+std::string serialise::default_context_to<serialise::bytes>::
+	to_string(const bytes& from) const
+{
+	std::string result;
+	append_to(result, from);
+	return result;
+}
+
+void serialise::default_context_to<serialise::bytes>::
+	append_to(std::string& to, const bytes& from) const
+{
+	const std::string& data = from.get_data();
+
+	std::string::size_type pos = to.size();
+	to.resize(pos + data.size() * 2);
+	for(std::string::size_type i = 0; i < data.size(); ++ i)
+	{
+		unsigned char byte = static_cast<unsigned char>(data[i]);
+		to[pos ++] = DIGITS[byte >> 4];
+		to[pos ++] = DIGITS[byte & 0x0f];
+	}
+}
+
+serialise::bytes serialise::default_context_from<serialise::bytes>::
+	from_string(const std::string& from) const
+{
+	if(from.length() % 2 != 0)
+	{
+		throw conversion_error(
+			"Could not convert \"" + from + "\" to bytes: "
+			"odd number of digits"
+		);
+	}
+
+	std::string data(from.length() / 2, '\0');
+	for(std::string::size_type i = 0; i < from.length(); ++ i)
+	{
+		char c = from[i];
+		unsigned int digit;
+		if(c >= '0' && c <= '9')
+			digit = c - '0';
+		else if(c >= 'a' && c <= 'f')
+			digit = c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F')
+			digit = c - 'A' + 10;
+		else
+			throw conversion_error(
+				"Could not convert \"" + from + "\" to bytes: "
+				"not a hexadecimal digit"
+			);
+
+		data[i / 2] = static_cast<char>(
+			(static_cast<unsigned char>(data[i / 2]) << 4) | digit
+		);
+	}
+
+	return bytes(data);
+}
@@ -0,0 +1,171 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <zlib.h>
+
+#include "compress.hpp"
+
+namespace
+{
+	// Size of the stack buffer zlib writes its output to
+	const unsigned int CHUNK_SIZE = 4096;
+}
+
+net6::deflate_stream::deflate_stream():
+	deflate_strm(new z_stream), inflate_strm(new z_stream),
+	deflate_in(0), deflate_out(0), inflate_in(0), inflate_out(0)
+{
+	deflate_strm->zalloc = Z_NULL;
+	deflate_strm->zfree = Z_NULL;
+	deflate_strm->opaque = Z_NULL;
+
+	inflate_strm->zalloc = Z_NULL;
+	inflate_strm->zfree = Z_NULL;
+	inflate_strm->opaque = Z_NULL;
+	inflate_strm->next_in = Z_NULL;
+	inflate_strm->avail_in = 0;
+
+	if(deflateInit(deflate_strm, Z_DEFAULT_COMPRESSION) != Z_OK)
+	{
+		delete deflate_strm;
+		delete inflate_strm;
+		throw std::bad_alloc();
+	}
+
+	if(inflateInit(inflate_strm) != Z_OK)
+	{
+		deflateEnd(deflate_strm);
+		delete deflate_strm;
+		delete inflate_strm;
+		throw std::bad_alloc();
+	}
+}
+
+net6::deflate_stream::~deflate_stream()
+{
+	deflateEnd(deflate_strm);
+	inflateEnd(inflate_strm);
+
+	delete deflate_strm;
+	delete inflate_strm;
+}
+
+void net6::deflate_stream::deflate(const char* data, size_type len, queue& to)
+{
+	char buffer[CHUNK_SIZE];
+
+	deflate_strm->next_in =
+		reinterpret_cast<Bytef*>(const_cast<char*>(data) );
+	deflate_strm->avail_in = len;
+
+	// Z_SYNC_FLUSH makes all input available to the remote inflater.
+	// We are done when zlib did not fill the whole output buffer.
+	do
+	{
+		deflate_strm->next_out = reinterpret_cast<Bytef*>(buffer);
+		deflate_strm->avail_out = CHUNK_SIZE;
+
+		if(::deflate(deflate_strm, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+		{
+			throw std::logic_error(
+				"net6::deflate_stream::deflate:\n"
+				"Inconsistent stream state"
+			);
+		}
+
+		to.append(buffer, CHUNK_SIZE - deflate_strm->avail_out);
+		deflate_out += CHUNK_SIZE - deflate_strm->avail_out;
+	} while(deflate_strm->avail_out == 0);
+
+	deflate_in += len;
+}
+
+void net6::deflate_stream::inflate(const char* data, size_type len, queue& to)
+{
+	inflate(data, len, to, ~static_cast<size_type>(0) );
+}
+
+net6::deflate_stream::size_type
+net6::deflate_stream::inflate(const char* data,
+                              size_type len,
+                              queue& to,
+                              size_type limit)
+{
+	char buffer[CHUNK_SIZE];
+
+	inflate_strm->next_in =
+		reinterpret_cast<Bytef*>(const_cast<char*>(data) );
+	inflate_strm->avail_in = len;
+
+	do
+	{
+		// Output zlib still holds without further input is bounded
+		// by its window, so that is taken out in any case.
+		if(to.get_size() >= limit && inflate_strm->avail_in > 0)
+			break;
+
+		inflate_strm->next_out = reinterpret_cast<Bytef*>(buffer);
+		inflate_strm->avail_out = CHUNK_SIZE;
+
+		int ret = ::inflate(inflate_strm, Z_SYNC_FLUSH);
+		switch(ret)
+		{
+		case Z_OK:
+		case Z_BUF_ERROR: // No progress possible, need more input
+			break;
+		case Z_STREAM_END:
+			throw compression_error(
+				"Remote site finished the compressed stream"
+			);
+		case Z_MEM_ERROR:
+			throw std::bad_alloc();
+		default:
+			throw compression_error(
+				inflate_strm->msg != NULL ?
+				inflate_strm->msg : "Corrupt compressed data"
+			);
+		}
+
+		to.append(buffer, CHUNK_SIZE - inflate_strm->avail_out);
+		inflate_out += CHUNK_SIZE - inflate_strm->avail_out;
+	} while(inflate_strm->avail_out == 0);
+
+	size_type used = len - inflate_strm->avail_in;
+	inflate_in += used;
+	return used;
+}
+
+uint64_t net6::deflate_stream::get_deflate_in() const
+{
+	return deflate_in;
+}
+
+uint64_t net6::deflate_stream::get_deflate_out() const
+{
+	return deflate_out;
+}
+
+uint64_t net6::deflate_stream::get_inflate_in() const
+{
+	return inflate_in;
+}
+
+uint64_t net6::deflate_stream::get_inflate_out() const
+{
+	return inflate_out;
+}
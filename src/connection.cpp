@@ -17,10 +17,23 @@
  */
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <utility>
+#include <vector>
 
+#include "config.hpp"
 #include "error.hpp"
 #include "connection.hpp"
 
+#ifdef WIN32
+# include <io.h>
+#else
+# include <unistd.h>
+# include <errno.h>
+#endif
+
 namespace
 {
 	// Send a keepalive when we got nothing from the remote site
@@ -30,20 +43,241 @@ namespace
 	// Wait half a minute for a reply after having sent a keepalive
 	// packet
 	const unsigned long KEEPALIVE_WAIT_TIME = 30000;
+
+	// Number of TCP keepalive probes sent within KEEPALIVE_WAIT_TIME
+	// when keepalives are offloaded to the kernel
+	const unsigned int KEEPALIVE_PROBE_COUNT = 3;
+
+	// Amount of data read from the socket at once when little data
+	// arrives, and the default maximum
+	const net6::queue::size_type MIN_RECV_SIZE = 1024;
+	const net6::queue::size_type DEFAULT_MAX_RECV_SIZE = 256 * 1024;
+
+	// Amount of data decompressed before splitting received packets
+	// again, so that little compressed data cannot fill up memory
+	// before the frame size is checked.
+	const net6::queue::size_type INFLATE_SIZE = 256 * 1024;
+
+	// Maximum amount of a file passed to the socket at once, so that
+	// progress is reported regularly
+	const net6::queue::size_type FILE_CHUNK_SIZE = 1024 * 1024;
+
+	// Amount of data moved from the priority queues to the send queue
+	// at once. Packets of higher priority have to wait until that
+	// much data has been sent.
+	const net6::queue::size_type SCHEDULE_SIZE = 64 * 1024;
+
+	// Amount of data a priority queue may send per turn and weight
+	const net6::queue::size_type PRIORITY_QUANTUM = 4096;
+
+	// Tokens in the bucket, or zero if there are too few to be worth
+	// waking up for
+	net6::queue::size_type get_tokens(net6::token_bucket& bucket)
+	{
+		net6::queue::size_type available = bucket.get_available();
+		if(available < std::min(MIN_RECV_SIZE, bucket.get_burst()) )
+			return 0;
+
+		return available;
+	}
+
+	// Current time in milliseconds for the deadlines of the timers
+	unsigned long now_msec()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+	}
+
+	// Reads len bytes of the file fd starting at offset into target
+	void read_file(net6::queue& target,
+	               int fd,
+	               off_t offset,
+	               net6::queue::size_type len)
+	{
+		char* buf = target.reserve(len);
+		net6::queue::size_type done = 0;
+
+		while(done < len)
+		{
+#ifdef WIN32
+			if(lseek(fd, offset + done, SEEK_SET) == -1)
+				throw net6::error(net6::error::SYSTEM);
+			int result = read(fd, buf + done, len - done);
+#else
+			ssize_t result = pread(fd, buf + done, len - done,
+			                       offset + done);
+#endif
+			if(result == -1)
+			{
+				if(errno == EINTR) continue;
+				throw net6::error(net6::error::SYSTEM);
+			}
+
+			if(result == 0)
+			{
+				throw std::runtime_error(
+					"net6::connection.cpp:read_file:\n"
+					"File is shorter than the data to send"
+				);
+			}
+
+			done += result;
+		}
+
+		target.commit(len);
+	}
+
+	// Zero-copy data of a closed connection that the kernel may still
+	// read from. The socket is kept open to receive the completions.
+	struct zerocopy_orphan
+	{
+		std::unique_ptr<net6::tcp_client_socket> sock;
+		std::vector<std::unique_ptr<net6::queue> > data;
+		unsigned long sends;
+		unsigned long completed;
+	};
+
+	std::list<zerocopy_orphan> zerocopy_orphans;
+
+	void release_zerocopy_orphans()
+	{
+		std::list<zerocopy_orphan>::iterator iter =
+			zerocopy_orphans.begin();
+
+		while(iter != zerocopy_orphans.end() )
+		{
+			try
+			{
+				iter->completed +=
+					iter->sock->read_zerocopy_completions();
+			}
+			catch(net6::error& e)
+			{
+				// There is no way left to find out
+				iter->completed = iter->sends;
+			}
+
+			if(iter->completed >= iter->sends)
+				iter = zerocopy_orphans.erase(iter);
+			else
+				++ iter;
+		}
+	}
+
+	// A received packet, a chunk of a streamed packet, or a signal
+	// caused by a received packet that has been handled immediately
+	struct received_item
+	{
+		enum item_type {
+			PACKET,
+			CHUNK,
+			COMPRESSED,
+			FILE_INLINED
+		};
+
+		received_item(net6::packet&& pack):
+			type(PACKET), pack(std::move(pack)) {}
+
+		received_item(
+			const std::shared_ptr<const net6::packet>& header,
+			unsigned int index,
+			std::string&& data,
+			net6::connection_base::chunk_position position
+		):
+			type(CHUNK), pack(std::string()), header(header),
+			index(index), data(std::move(data)),
+			position(position) {}
+
+		received_item(item_type type, int fd = -1,
+		              net6::queue::size_type total = 0):
+			type(type), pack(std::string()), fd(fd), total(total) {}
+
+		item_type type;
+		net6::packet pack;
+
+		// Set for chunks only
+		std::shared_ptr<const net6::packet> header;
+		unsigned int index;
+		std::string data;
+		net6::connection_base::chunk_position position;
+
+		// Set for inlined files only
+		int fd;
+		net6::queue::size_type total;
+	};
+}
+
+net6::connection_stats::connection_stats():
+	bytes_in(0), bytes_out(0), packets_in(0), packets_out(0),
+	recv_calls(0), send_calls(0), peak_sendqueue(0), peak_recvqueue(0),
+	outgoing_wait(0), connections(0), encrypted(0), compressed(0)
+{
+}
+
+net6::connection_stats&
+net6::connection_stats::operator+=(const connection_stats& other)
+{
+	bytes_in += other.bytes_in;
+	bytes_out += other.bytes_out;
+	packets_in += other.packets_in;
+	packets_out += other.packets_out;
+	recv_calls += other.recv_calls;
+	send_calls += other.send_calls;
+	peak_sendqueue = std::max(peak_sendqueue, other.peak_sendqueue);
+	peak_recvqueue = std::max(peak_recvqueue, other.peak_recvqueue);
+	outgoing_wait += other.outgoing_wait;
+	connections += other.connections;
+	encrypted += other.encrypted;
+	compressed += other.compressed;
+	return *this;
 }
 
 net6::connection_base::connection_base():
-	remote_sock(NULL),
+	current_priority(PRIORITY_INTERACTIVE),
+	max_starvation(0),
+	sendqueue_removed(0),
+	wire_sent(0),
+	zerocopy(ZEROCOPY_UNKNOWN),
+	zerocopy_threshold(0),
+	zerocopy_sends(0),
+	zerocopy_completed(0),
 	encrypted_sock(NULL),
-	remote_addr(NULL),
 	state(CLOSED),
 	keepalive(KEEPALIVE_DISABLED),
-	params(NULL)
+	keepalive_user_timeout(false),
+	compression(COMPRESSION_DISABLED),
+	cork_count(0),
+	sock_corked(false),
+	params(NULL),
+	shared_recv_limit(NULL),
+	shared_send_limit(NULL),
+	throttled(IO_NONE),
+	throttle_deadline(0),
+	keepalive_deadline(0),
+	flush(FLUSH_NONE),
+	flush_deadline(0),
+	outgoing_since(0),
+	max_frame_size(0),
+	stream_threshold(0),
+	recv_size(MIN_RECV_SIZE),
+	max_recv_size(DEFAULT_MAX_RECV_SIZE),
+	recv_scanned(0),
+	stream_index(0),
+	stream_raw(false),
+	stream_remaining(0)
 {
+	priorities[PRIORITY_INTERACTIVE].weight = 16;
+	priorities[PRIORITY_NORMAL].weight = 4;
+	priorities[PRIORITY_BULK].weight = 1;
+
+	for(unsigned int i = 0; i <= PRIORITY_BULK; ++ i)
+		priorities[i].deficit = 0;
 }
 
 net6::connection_base::~connection_base()
 {
+	orphan_zerocopy();
 }
 
 void net6::connection_base::connect(const address& addr)
@@ -58,6 +292,7 @@ void net6::connection_base::connect(const address& addr)
 
 	remote_sock.reset(new tcp_client_socket(addr) );
 	setup_signal();
+	init_stats();
 
 	remote_addr.reset(addr.clone() );
 	state = UNENCRYPTED;
@@ -66,9 +301,36 @@ void net6::connection_base::connect(const address& addr)
 
 	if(keepalive == KEEPALIVE_ENABLED)
 		start_keepalive_timer();
+	else if(keepalive == KEEPALIVE_KERNEL)
+		set_kernel_keepalive(true);
+}
+
+void net6::connection_base::connect_async(const address& addr)
+{
+	if(state != CLOSED)
+	{
+		throw std::logic_error(
+			"net6::connection_base::connect_async:\n"
+			"Connection is not closed"
+		);
+	}
+
+	remote_sock.reset(new tcp_client_socket(addr, false) );
+	setup_signal();
+	init_stats();
+
+	remote_addr.reset(addr.clone() );
+	state = CONNECTING;
+
+	// The socket becomes writable when the connection attempt has
+	// finished.
+	set_select(IO_ERROR | IO_OUTGOING);
+
+	if(keepalive == KEEPALIVE_KERNEL)
+		set_kernel_keepalive(true);
 }
 
-void net6::connection_base::assign(std::auto_ptr<tcp_client_socket> sock,
+void net6::connection_base::assign(std::unique_ptr<tcp_client_socket> sock,
                                    const address& addr)
 {
 	if(state != CLOSED)
@@ -79,8 +341,9 @@ void net6::connection_base::assign(std::auto_ptr<tcp_client_socket> sock,
 		);
 	}
 
-	remote_sock = sock;
+	remote_sock = std::move(sock);
 	setup_signal();
+	init_stats();
 
 	remote_addr.reset(addr.clone() );
 	state = UNENCRYPTED;
@@ -88,6 +351,8 @@ void net6::connection_base::assign(std::auto_ptr<tcp_client_socket> sock,
 	set_select(IO_ERROR | IO_INCOMING);
 	if(keepalive == KEEPALIVE_ENABLED)
 		start_keepalive_timer();
+	else if(keepalive == KEEPALIVE_KERNEL)
+		set_kernel_keepalive(true);
 }
 
 const net6::address& net6::connection_base::get_remote_address() const
@@ -118,37 +383,226 @@ const net6::tcp_client_socket& net6::connection_base::get_socket() const
 
 void net6::connection_base::set_enable_keepalives(bool enable)
 {
-	if(keepalive == KEEPALIVE_DISABLED && enable == true)
+	set_enable_keepalives(enable, KEEPALIVE_PACKETS);
+}
+
+void net6::connection_base::set_enable_keepalives(bool enable,
+                                                  keepalive_mode mode)
+{
+	// Switching modes disables the previous one first
+	if(keepalive == KEEPALIVE_KERNEL &&
+	   (enable == false || mode != KEEPALIVE_OFFLOADED) )
 	{
-		keepalive = KEEPALIVE_ENABLED;
-		if(state == UNENCRYPTED || state == ENCRYPTED)
-			start_keepalive_timer();
+		keepalive = KEEPALIVE_DISABLED;
+		if(state != CLOSED)
+			set_kernel_keepalive(false);
 	}
-	else if(enable == false)
+	else if(keepalive != KEEPALIVE_DISABLED &&
+	        (enable == false || mode != KEEPALIVE_PACKETS) )
 	{
 		keepalive = KEEPALIVE_DISABLED;
 		stop_keepalive_timer();
 	}
+
+	if(keepalive == KEEPALIVE_DISABLED && enable == true)
+	{
+		if(mode == KEEPALIVE_OFFLOADED)
+		{
+			keepalive = KEEPALIVE_KERNEL;
+			if(state != CLOSED)
+				set_kernel_keepalive(true);
+		}
+		else
+		{
+			keepalive = KEEPALIVE_ENABLED;
+			if(state == UNENCRYPTED || state == ENCRYPTED)
+				start_keepalive_timer();
+		}
+	}
+}
+
+bool net6::connection_base::get_enable_keepalives() const
+{
+	return keepalive != KEEPALIVE_DISABLED;
 }
 
 void net6::connection_base::send(const packet& pack)
+{
+	enqueue(pack, PRIORITY_NORMAL, false, 0);
+}
+
+void net6::connection_base::send(packet&& pack)
+{
+	// The packet is serialised into the send queue right away, so
+	// there is no storage that could be taken over.
+	send(static_cast<const packet&>(pack) );
+}
+
+void net6::connection_base::send(const packet& pack, unsigned long token)
+{
+	enqueue(pack, PRIORITY_NORMAL, true, token);
+}
+
+void net6::connection_base::send(const packet& pack, send_priority priority)
+{
+	enqueue(pack, priority, false, 0);
+}
+
+void net6::connection_base::send(const packet& pack,
+                                 send_priority priority,
+                                 unsigned long token)
+{
+	enqueue(pack, priority, true, token);
+}
+
+void net6::connection_base::set_priority_weight(send_priority priority,
+                                                unsigned int weight)
+{
+	if(weight == 0)
+	{
+		throw std::logic_error(
+			"net6::connection_base::set_priority_weight:\n"
+			"Weight must not be zero"
+		);
+	}
+
+	priorities[priority].weight = weight;
+}
+
+unsigned int
+net6::connection_base::get_priority_weight(send_priority priority) const
+{
+	return priorities[priority].weight;
+}
+
+void net6::connection_base::set_max_starvation(unsigned long msec)
+{
+	max_starvation = msec;
+}
+
+unsigned long net6::connection_base::get_max_starvation() const
+{
+	return max_starvation;
+}
+
+void net6::connection_base::send_file(const packet& header,
+                                      int fd,
+                                      off_t offset,
+                                      queue::size_type len)
 {
 	if(state == CLOSED)
 	{
 		throw std::logic_error(
-			"net6::connection_base::send:\n"
+			"net6::connection_base::send_file:\n"
 			"Connection is closed"
 		);
 	}
 
-	pack.enqueue(sendqueue);
+	if(flush != FLUSH_NONE)
+	{
+		throw std::logic_error(
+			"net6::connection_base::send_file:\n"
+			"Connection is being closed"
+		);
+	}
+
+	// The body follows the frame verbatim, the remote site reads as
+	// much as announced here.
+	packet frame("net6_file", header.get_param_count() + 2);
+	frame << len << header.get_command();
+	for(unsigned int i = 0; i < header.get_param_count(); ++ i)
+		frame.params.push_back(header.get_param(i) );
+
+	// The file is sent in order with normal packets
+	schedule_all(PRIORITY_NORMAL);
+
+	queue::size_type prev_size = sendqueue.get_total_size();
+	frame.enqueue(sendqueue);
+	++ stats.packets_out;
 
-	if(sendqueue.get_size() > 0)
+	if(len > 0 && (state == CONNECTING || state == UNENCRYPTED) &&
+	   compression == COMPRESSION_DISABLED)
 	{
-		io_condition flags = get_select();
-		if( (flags & IO_OUTGOING) == 0)
-			set_select(flags | IO_OUTGOING);
+		file_transfer transfer = {
+			fd, offset, len, len, sendqueue.get_size()
+		};
+
+		file_transfers.push_back(transfer);
+		select_outgoing();
+	}
+	else
+	{
+		try
+		{
+			read_file(sendqueue, fd, offset, len);
+		}
+		catch(...)
+		{
+			sendqueue.truncate(prev_size);
+			-- stats.packets_out;
+			throw;
+		}
+
+		select_outgoing();
+		signal_file_progress.emit(fd, len, len);
+	}
+}
+
+void net6::connection_base::close_after_flush(unsigned long timeout)
+{
+	if(state == CLOSED)
+	{
+		throw std::logic_error(
+			"net6::connection_base::close_after_flush:\n"
+			"Connection is closed"
+		);
+	}
+
+	if(flush != FLUSH_NONE)
+	{
+		throw std::logic_error(
+			"net6::connection_base::close_after_flush:\n"
+			"Connection is already being closed"
+		);
+	}
+
+	flush = FLUSH_PENDING;
+	if(timeout > 0)
+		flush_deadline = now_msec() + timeout;
+
+	// The remote site is going to be closed anyway, no need to check
+	// whether it is still alive.
+	stop_keepalive_timer();
+	check_flushed();
+}
+
+bool net6::connection_base::is_flushing() const
+{
+	return flush != FLUSH_NONE;
+}
+
+void net6::connection_base::cork()
+{
+	++ cork_count;
+}
+
+void net6::connection_base::uncork()
+{
+	if(cork_count == 0)
+	{
+		throw std::logic_error(
+			"net6::connection_base::uncork:\n"
+			"Connection is not corked"
+		);
 	}
+
+	if(-- cork_count == 0 && state != CLOSED)
+		select_outgoing();
+}
+
+bool net6::connection_base::is_corked() const
+{
+	return cork_count > 0;
 }
 
 void net6::connection_base::request_encryption(bool as_client)
@@ -161,10 +615,18 @@ void net6::connection_base::request_encryption(bool as_client)
 		);
 	}
 
+	if(compression == COMPRESSION_REQUESTED)
+	{
+		throw std::logic_error(
+			"net6::connection::request_encryption:\n"
+			"Compression request is pending"
+		);
+	}
+
 	// Request encryption from other side
 	packet pack("net6_encryption");
 	pack << as_client;
-	send(pack);
+	enqueue(pack);
 
 	// Wait for net6_encryption_ok or net6_encryption_failed
 	if(as_client)
@@ -195,98 +657,395 @@ void net6::connection_base::set_dh_params(dh_params& new_params)
 	params = &new_params;
 }
 
-net6::connection_base::signal_recv_type
-net6::connection_base::recv_event() const
+void net6::connection_base::request_compression()
 {
-	return signal_recv;
+	if(compression != COMPRESSION_DISABLED)
+	{
+		throw std::logic_error(
+			"net6::connection::request_compression:\n"
+			"Compression request has already been performed"
+		);
+	}
+
+	if(state != UNENCRYPTED && state != ENCRYPTED)
+	{
+		throw std::logic_error(
+			"net6::connection::request_compression:\n"
+			"Connection is closed or encryption is being negotiated"
+		);
+	}
+
+	packet pack("net6_compression");
+	enqueue(pack);
+
+	// Further traffic must be compressed, so keep it in the queue until
+	// we know whether the other side agrees.
+	sendqueue.block();
+	compression = COMPRESSION_REQUESTED;
 }
 
-net6::connection_base::signal_send_type
-net6::connection_base::send_event() const
+bool net6::connection_base::is_compressed() const
 {
-	return signal_send;
+	return compression == COMPRESSION_ENABLED;
 }
 
-net6::connection_base::signal_close_type
-net6::connection_base::close_event() const
+const net6::deflate_stream* net6::connection_base::get_deflate_stream() const
 {
-	return signal_close;
+	return zstream.get();
 }
 
-net6::connection_base::signal_encrypted_type
-net6::connection_base::encrypted_event() const
+void net6::connection_base::set_max_frame_size(queue::size_type size)
 {
-	return signal_encrypted;
+	max_frame_size = size;
 }
 
-net6::connection_base::signal_encryption_failed_type
-net6::connection_base::encryption_failed_event() const
+net6::queue::size_type net6::connection_base::get_max_frame_size() const
 {
-	return signal_encryption_failed;
+	return max_frame_size;
 }
 
-void net6::connection_base::on_sock_event(io_condition io)
+void net6::connection_base::set_stream_threshold(queue::size_type size)
 {
-	try
-	{
-		do_io(io);
-	}
-	catch(net6::error& e)
-	{
-		// Allow users to set sockets to non-blocking in which case
-		// we might get EAGAIN here.
-		if(e.get_code() == error::WOULD_BLOCK)
-			return;
+	stream_threshold = size;
+}
 
-		// We should not throw any error here because it would fall
-		// through to the selector. If something went wrong, then
-		// we have to handle it here.
-		/*if(e.get_code() == error::CONNECTION_RESET ||
-		   e.get_code() == error::BROKEN_PIPE ||
-		   e.get_code() == error::PULL_ERROR ||
-		   e.get_code() == error::PUSH_ERROR ||
-		   e.get_code() == error::UNEXPECTED_PACKET ||
-		   e.get_code() == error::UNEXPECTED_HANDSHAKE ||
-		   e.get_code() == error::UNEXPECTED_PACKET_LENGTH ||
-		   e.get_code() == error::UNKNOWN)*/
-		{
-			on_close();
-		}
-		/*else
-		{
-			throw e;
-		}*/
-	}
+net6::queue::size_type net6::connection_base::get_stream_threshold() const
+{
+	return stream_threshold;
 }
 
-void net6::connection_base::do_io(io_condition io)
+void net6::connection_base::set_max_recv_size(queue::size_type size)
 {
-	if(io & IO_INCOMING)
+	if(size == 0)
 	{
-		if(state == ENCRYPTION_HANDSHAKING)
-		{
-			do_handshake();
-			return;
-		}
+		throw std::logic_error(
+			"net6::connection_base::set_max_recv_size:\n"
+			"Maximum receive size must not be zero"
+		);
+	}
 
-		char buffer[1024];
-		socket::size_type bytes = remote_sock->recv(buffer, 1024);
+	max_recv_size = size;
+}
 
-		if(bytes == 0)
-		{
+net6::queue::size_type net6::connection_base::get_max_recv_size() const
+{
+	return max_recv_size;
+}
+
+void net6::connection_base::set_recv_rate(queue::size_type rate,
+                                          queue::size_type burst)
+{
+	recv_limit.set_rate(rate, burst);
+}
+
+net6::queue::size_type net6::connection_base::get_recv_rate() const
+{
+	return recv_limit.get_rate();
+}
+
+void net6::connection_base::set_send_rate(queue::size_type rate,
+                                          queue::size_type burst)
+{
+	send_limit.set_rate(rate, burst);
+}
+
+net6::queue::size_type net6::connection_base::get_send_rate() const
+{
+	return send_limit.get_rate();
+}
+
+void net6::connection_base::set_shared_recv_limit(token_bucket* bucket)
+{
+	shared_recv_limit = bucket;
+}
+
+void net6::connection_base::set_shared_send_limit(token_bucket* bucket)
+{
+	shared_send_limit = bucket;
+}
+
+void net6::connection_base::set_zerocopy_threshold(queue::size_type size)
+{
+	zerocopy_threshold = size;
+}
+
+net6::queue::size_type net6::connection_base::get_zerocopy_threshold() const
+{
+	return zerocopy_threshold;
+}
+
+net6::connection_stats net6::connection_base::get_stats() const
+{
+	connection_stats result(stats);
+	if(state != CLOSED) result.connections = 1;
+	if(state == ENCRYPTED) result.encrypted = 1;
+	if(compression == COMPRESSION_ENABLED) result.compressed = 1;
+
+	// Include the time the current data is already waiting
+	if(outgoing_since != 0)
+		result.outgoing_wait += now_msec() - outgoing_since;
+
+	return result;
+}
+
+net6::connection_base::signal_connected_type
+net6::connection_base::connected_event() const
+{
+	return signal_connected;
+}
+
+net6::connection_base::signal_connect_failed_type
+net6::connection_base::connect_failed_event() const
+{
+	return signal_connect_failed;
+}
+
+net6::connection_base::signal_recv_type
+net6::connection_base::recv_event() const
+{
+	return signal_recv;
+}
+
+net6::connection_base::signal_send_type
+net6::connection_base::send_event() const
+{
+	return signal_send;
+}
+
+net6::connection_base::signal_packet_sent_type
+net6::connection_base::packet_sent_event() const
+{
+	return signal_packet_sent;
+}
+
+net6::connection_base::signal_close_type
+net6::connection_base::close_event() const
+{
+	return signal_close;
+}
+
+net6::connection_base::signal_encrypted_type
+net6::connection_base::encrypted_event() const
+{
+	return signal_encrypted;
+}
+
+net6::connection_base::signal_encryption_failed_type
+net6::connection_base::encryption_failed_event() const
+{
+	return signal_encryption_failed;
+}
+
+net6::connection_base::signal_compressed_type
+net6::connection_base::compressed_event() const
+{
+	return signal_compressed;
+}
+
+net6::connection_base::signal_compression_failed_type
+net6::connection_base::compression_failed_event() const
+{
+	return signal_compression_failed;
+}
+
+net6::connection_base::signal_frame_too_large_type
+net6::connection_base::frame_too_large_event() const
+{
+	return signal_frame_too_large;
+}
+
+net6::connection_base::signal_param_chunk_type
+net6::connection_base::param_chunk_event() const
+{
+	return signal_param_chunk;
+}
+
+net6::connection_base::signal_file_progress_type
+net6::connection_base::file_progress_event() const
+{
+	return signal_file_progress;
+}
+
+void net6::connection_base::on_sock_event(io_condition io)
+{
+	try
+	{
+		do_io(io);
+	}
+	catch(net6::error& e)
+	{
+		// Allow users to set sockets to non-blocking in which case
+		// we might get EAGAIN here.
+		if(e.get_code() == error::WOULD_BLOCK)
+			return;
+
+		// We should not throw any error here because it would fall
+		// through to the selector. If something went wrong, then
+		// we have to handle it here.
+		/*if(e.get_code() == error::CONNECTION_RESET ||
+		   e.get_code() == error::BROKEN_PIPE ||
+		   e.get_code() == error::PULL_ERROR ||
+		   e.get_code() == error::PUSH_ERROR ||
+		   e.get_code() == error::UNEXPECTED_PACKET ||
+		   e.get_code() == error::UNEXPECTED_HANDSHAKE ||
+		   e.get_code() == error::UNEXPECTED_PACKET_LENGTH ||
+		   e.get_code() == error::UNKNOWN)*/
+		{
+			on_close();
+		}
+		/*else
+		{
+			throw e;
+		}*/
+	}
+	catch(compression_error& e)
+	{
+		std::cerr << "net6 warning: Failed to decompress data from "
+		          << remote_addr->get_name() << ": " << e.what()
+		          << std::endl;
+
+		on_close();
+	}
+}
+
+void net6::connection_base::do_io(io_condition io)
+{
+	if(state == CONNECTING)
+	{
+		if(io & (IO_OUTGOING | IO_ERROR) )
+		{
+			finish_connect();
+		}
+		else if( (io & IO_TIMEOUT) && flush_deadline != 0 &&
+		         now_msec() >= flush_deadline)
+		{
+			// close_after_flush() has been called while connecting
+			// and the connection has not been established in time.
+			on_close();
+		}
+
+		return;
+	}
+
+	if( (io & IO_INCOMING) && !zerocopy_segments.empty() )
+	{
+		// Completions of zero-copy sends make the socket readable
+		// as well, even if there is nothing to receive.
+		release_zerocopy();
+		if(!remote_sock->is_readable() )
+			io &= ~IO_INCOMING;
+	}
+
+	// Leave the data in the kernel if the rate limit is exceeded
+	queue::size_type recv_allowed = 0;
+	if( (io & IO_INCOMING) && state != ENCRYPTION_HANDSHAKING)
+	{
+		recv_allowed = get_allowance(IO_INCOMING);
+		if(recv_allowed == 0)
+			io &= ~IO_INCOMING;
+	}
+
+	if(io & IO_INCOMING)
+	{
+		if(state == ENCRYPTION_HANDSHAKING)
+		{
+			do_handshake();
+			return;
+		}
+
+		// Read as much as the kernel has buffered if the previous
+		// read filled the buffer, the remote site sends faster than
+		// we read then.
+		queue::size_type len = std::min(recv_size, max_recv_size);
+		if(recv_size > MIN_RECV_SIZE)
+		{
+			len = std::max<queue::size_type>(
+				len,
+				std::min<queue::size_type>(
+					remote_sock->get_available(),
+					max_recv_size
+				)
+			);
+		}
+
+		len = std::min(len, recv_allowed);
+
+		// Compressed data is inflated into recvqueue afterwards
+		queue& target = (compression == COMPRESSION_ENABLED) ?
+			recvbuffer : recvqueue;
+		queue::size_type prev_size = target.get_total_size();
+
+		socket::size_type bytes;
+		error::code code =
+			remote_sock->try_recv(target.reserve(len), len, bytes);
+		++ stats.recv_calls;
+
+		if(code != error::NONE)
+		{
+			handle_io_error(code);
+			return;
+		}
+
+		if(bytes == 0)
+		{
 			on_close();
 			return;
 		}
 
+		target.commit(bytes);
+
+		if(bytes == len)
+			recv_size = std::min(len * 2, max_recv_size);
+		else if(bytes < recv_size / 4)
+			recv_size = std::max(recv_size / 2, MIN_RECV_SIZE);
+
+		// Drain data that GnuTLS has already decrypted, since the
+		// socket will not be selected for it.
+		while(encrypted_sock != NULL)
+		{
+			queue::size_type pending = encrypted_sock->get_pending();
+			if(pending == 0) break;
+
+			code = remote_sock->try_recv(
+				target.reserve(pending),
+				pending,
+				bytes
+			);
+
+			if(code != error::NONE)
+			{
+				handle_io_error(code);
+				return;
+			}
+
+			target.commit(bytes);
+
+			if(bytes != pending)
+			{
+				throw std::logic_error(
+					"net6::connection::do_io:\n"
+					"Did not receive all data from "
+					"GnuTLS cache"
+				);
+			}
+		}
+
+		// Data from the GnuTLS cache counts as well, the limit
+		// then takes longer to recover.
+		queue::size_type received = target.get_total_size() - prev_size;
+		consume_tokens(IO_INCOMING, received);
+		stats.bytes_in += received;
+
 		// Got something
 		switch(keepalive)
 		{
 		case KEEPALIVE_ENABLED:
-			// Refresh keepalive timer
-			if(get_timeout() < KEEPALIVE_INTERVAL_TIME * 9 / 10)
-				set_timeout(KEEPALIVE_INTERVAL_TIME);
+			// Refresh keepalive timer, or start it if it is not
+			// running
+			if(keepalive_deadline < now_msec() +
+			   KEEPALIVE_INTERVAL_TIME * 9 / 10)
+				start_keepalive_timer();
 
-			io &= ~IO_TIMEOUT;
 			break;
 		case KEEPALIVE_WAITING:
 			// Got something we waited for. Note that this must
@@ -294,61 +1053,194 @@ void net6::connection_base::do_io(io_condition io)
 			// connection is alive and that is all we wanted to
 			// know.
 			keepalive = KEEPALIVE_ENABLED;
-
-			set_timeout(KEEPALIVE_INTERVAL_TIME);
-			io &= ~IO_TIMEOUT;
+			start_keepalive_timer();
 			break;
 		default:
 			break;
 		}
 
-		recvqueue.append(buffer, bytes);
+		inflate_received();
+
+		if(recvqueue.get_size() > stats.peak_recvqueue)
+			stats.peak_recvqueue = recvqueue.get_size();
+
+		// Store packets first to allow signal handlers to
+		// delete the connection object
+		std::vector<received_item> items;
+		bool too_large = false;
+		bool bad_file = false;
 
-		// Clear remaining data in GnuTLS cache
-		if(encrypted_sock != NULL && encrypted_sock->get_pending() > 0)
+		while(true)
 		{
-			tcp_encrypted_socket_base::size_type size =
-				encrypted_sock->get_pending();
+			if(stream_header)
+			{
+				std::string data;
+				chunk_position position;
+				unsigned int index = stream_index;
+
+				if(!stream_received(data, position) )
+				{
+					if(inflate_received() ) continue;
+					break;
+				}
+
+				items.emplace_back(
+					stream_header,
+					index,
+					std::move(data),
+					position
+				);
+
+				if(position == CHUNK_FRAME_END)
+					stream_header.reset();
 
-			char* ch_buf = new char[size];
-			bytes = remote_sock->recv(ch_buf, size);
+				continue;
+			}
 
-			recvqueue.append(ch_buf, size);
-			delete[] ch_buf;
+			queue::size_type pos =
+				recvqueue.packet_size(recv_scanned);
 
-			if(bytes != size)
+			if(pos == recvqueue.get_size() )
 			{
-				throw std::logic_error(
-					"net6::connection::do_io:\n"
-					"Did not receive all data from "
-					"GnuTLS cache"
-				);
+				// Incomplete packet
+				recv_scanned = pos;
+
+				if(stream_threshold > 0 &&
+				   pos > stream_threshold && begin_stream() )
+				{
+					++ stats.packets_in;
+					continue;
+				}
+
+				if(max_frame_size > 0 && pos > max_frame_size)
+					too_large = true;
+				else if(inflate_received() )
+					continue;
+
+				break;
 			}
-		}
 
-		// Store packets first to allow signal handlers to
-		// delete the connection object
-		std::list<packet> packet_list;
+			if(max_frame_size > 0 && pos > max_frame_size)
+			{
+				too_large = true;
+				break;
+			}
 
-		try
-		{
-			while(true)
+			recv_scanned = 0;
+			packet pack(recvqueue);
+			++ stats.packets_in;
+
+			// The file body follows verbatim. Without a valid
+			// header its end is unknown, so the connection
+			// cannot be used any further.
+			if(pack.get_command() == "net6_file")
+			{
+				if(begin_file(pack) ) continue;
+
+				bad_file = true;
+				break;
+			}
+
+			// Everything the remote site sends after these
+			// packets is compressed, so they have to be
+			// handled before splitting further packets. The
+			// signals wait for the packets received before.
+			if(pack.get_command() == "net6_compression" ||
+			   pack.get_command() == "net6_compression_ok")
+			{
+				compression_state prev = compression;
+				on_recv(pack);
+
+				if(prev == COMPRESSION_ENABLED ||
+				   compression != COMPRESSION_ENABLED)
+					continue;
+
+				for(std::deque<file_transfer>::const_iterator
+					iter = inlined_files.begin();
+				    iter != inlined_files.end();
+				    ++ iter)
+				{
+					items.emplace_back(
+						received_item::FILE_INLINED,
+						iter->fd,
+						iter->total
+					);
+				}
+
+				inlined_files.clear();
+				items.emplace_back(received_item::COMPRESSED);
+			}
+			else
 			{
-				packet_list.push_back(packet(recvqueue) );
+				items.emplace_back(std::move(pack) );
 			}
 		}
-		catch(packet::end_of_queue&) {}
 
 		// Emit signal now as we do not depend anymore on members.
-		for(std::list<packet>::iterator iter = packet_list.begin();
-		    iter != packet_list.end();
-		    ++ iter)
+		for(std::vector<received_item>::size_type i = 0;
+		    i < items.size();
+		    ++ i)
+		{
+			const received_item& item = items[i];
+			switch(item.type)
+			{
+			case received_item::PACKET:
+				on_recv(item.pack);
+				break;
+			case received_item::CHUNK:
+				signal_param_chunk.emit(
+					*item.header,
+					item.index,
+					item.data,
+					item.position
+				);
+				break;
+			case received_item::COMPRESSED:
+				signal_compressed.emit();
+				break;
+			case received_item::FILE_INLINED:
+				signal_file_progress.emit(
+					item.fd,
+					item.total,
+					item.total
+				);
+				break;
+			}
+		}
+
+		if(too_large)
+		{
+			signal_frame_too_large.emit();
+			on_close();
+			return;
+		}
+
+		if(bad_file)
 		{
-			on_recv(*iter);
+			on_close();
+			return;
 		}
 	}
 
-	if(io & IO_OUTGOING)
+	// Keep the data queued if the rate limit is exceeded
+	queue::size_type send_allowed = 0;
+	if( (io & IO_OUTGOING) && cork_count == 0 &&
+	   state != ENCRYPTION_HANDSHAKING)
+	{
+		send_allowed = get_allowance(IO_OUTGOING);
+		if(send_allowed == 0)
+			io &= ~IO_OUTGOING;
+	}
+
+	if( (io & IO_OUTGOING) && cork_count > 0)
+	{
+		// Will be selected again by uncork()
+		outgoing_since = 0;
+		io_condition flags = get_select();
+		if( (flags & IO_OUTGOING) == IO_OUTGOING)
+			set_select(flags & ~IO_OUTGOING);
+	}
+	else if(io & IO_OUTGOING)
 	{
 		if(state == ENCRYPTION_HANDSHAKING)
 		{
@@ -356,249 +1248,1250 @@ void net6::connection_base::do_io(io_condition io)
 			return;
 		}
 
-		if(sendqueue.get_size() == 0)
+		// Move waiting packets to the send queue in order of their
+		// priority
+		schedule();
+
+		// Compress everything that is ready to be sent. The sync flush
+		// at the end makes up a flush point at a packet boundary.
+		if(compression == COMPRESSION_ENABLED &&
+		   sendqueue.get_size() > 0)
 		{
-			throw std::logic_error(
-				"net6::connection::do_io:\n"
-				"Nothing to send in send queue"
-			);
+			queue::size_type len = sendqueue.get_size();
+			zstream->deflate(sendqueue.get_data(), len, wirequeue);
+
+			sendqueue.remove(len);
+			move_pending_sends(len);
 		}
 
-		socket::size_type bytes = remote_sock->send(
-			sendqueue.get_data(),
-			sendqueue.get_size()
-		);
+		// Data in wirequeue has been queued before anything that is
+		// still in sendqueue.
+		queue& outqueue =
+			(wirequeue.get_size() > 0) ? wirequeue : sendqueue;
 
-		if(bytes <= 0)
+		socket::size_type bytes;
+		const file_transfer* progress = NULL;
+		file_transfer completed;
+
+		if(has_zerocopy_data() || begin_zerocopy(outqueue) )
 		{
-			on_close();
-			return;
+			// Zero-copy data has been queued before anything else
+			zerocopy_segment& segment = zerocopy_segments.back();
+			bool zerocopy_sent = remote_sock->send_zerocopy(
+				segment.data->get_data() + segment.sent,
+				std::min(
+					segment.data->get_size() - segment.sent,
+					send_allowed
+				),
+				bytes
+			);
+
+			if(zerocopy_sent)
+				segment.last_send = ++ zerocopy_sends;
+
+			segment.sent += bytes;
 		}
+		else if(&outqueue == &sendqueue && !file_transfers.empty() &&
+		        file_transfers.front().position == 0)
+		{
+			// Everything queued before the file has been sent
+			file_transfer& transfer = file_transfers.front();
+			bytes = remote_sock->send_file(
+				transfer.fd,
+				transfer.offset,
+				std::min(
+					std::min(transfer.remaining, FILE_CHUNK_SIZE),
+					send_allowed
+				)
+			);
 
-		sendqueue.remove(bytes);
-		if(sendqueue.get_size() == 0)
-			on_send();
-	}
+			transfer.offset += bytes;
+			transfer.remaining -= bytes;
+			sendqueue_removed += bytes;
+			progress = &transfer;
 
-	if(io & IO_TIMEOUT)
+			if(transfer.remaining == 0)
+			{
+				completed = transfer;
+				progress = &completed;
+				file_transfers.pop_front();
+			}
+		}
+		else
+		{
+			// Do not send data queued behind a pending file
+			queue::size_type len = outqueue.get_size();
+			if(&outqueue == &sendqueue && !file_transfers.empty() )
+				len = std::min(len, file_transfers.front().position);
+
+			if(len == 0)
+			{
+				throw std::logic_error(
+					"net6::connection::do_io:\n"
+					"Nothing to send in send queue"
+				);
+			}
+
+			error::code code = remote_sock->try_send(
+				outqueue.get_data(),
+				std::min(len, send_allowed),
+				bytes
+			);
+
+			if(code != error::NONE)
+			{
+				handle_io_error(code);
+				return;
+			}
+
+			if(bytes > 0)
+			{
+				outqueue.remove(bytes);
+
+				if(&outqueue == &sendqueue)
+				{
+					sendqueue_removed += bytes;
+
+					for(std::deque<file_transfer>::iterator iter =
+						file_transfers.begin();
+					    iter != file_transfers.end();
+					    ++ iter)
+					{
+						iter->position -= bytes;
+					}
+				}
+			}
+		}
+
+		if(bytes <= 0)
+		{
+			on_close();
+			return;
+		}
+
+		consume_tokens(IO_OUTGOING, bytes);
+		stats.bytes_out += bytes;
+		++ stats.send_calls;
+		wire_sent += bytes;
+
+		std::vector<unsigned long> sent_tokens;
+		while(!pending_sends.empty() )
+		{
+			const pending_send& pending = pending_sends.front();
+			if(pending.end > (pending.on_wire ?
+				wire_sent : sendqueue_removed) )
+				break;
+
+			sent_tokens.push_back(pending.token);
+			pending_sends.pop_front();
+		}
+
+		// The data has waited for the socket since it was selected
+		// or since the previous write.
+		unsigned long now = now_msec();
+		if(outgoing_since != 0)
+			stats.outgoing_wait += now - outgoing_since;
+		outgoing_since = now;
+
+		if(progress != NULL)
+		{
+			signal_file_progress.emit(
+				progress->fd,
+				progress->total - progress->remaining,
+				progress->total
+			);
+		}
+
+		for(std::vector<unsigned long>::size_type i = 0;
+		    i < sent_tokens.size();
+		    ++ i)
+		{
+			signal_packet_sent.emit(sent_tokens[i]);
+		}
+
+		if(has_outgoing_data() )
+		{
+			// Keep the kernel from sending the remainder of a
+			// partial write in small segments.
+			if(!sock_corked)
+				sock_corked = remote_sock->set_cork(true);
+		}
+		else
+		{
+			if(sock_corked)
+			{
+				remote_sock->set_cork(false);
+				sock_corked = false;
+			}
+
+			outgoing_since = 0;
+			on_send();
+		}
+	}
+
+	if(io & IO_TIMEOUT)
+	{
+		// The keepalive and the rate limit share the timer of the
+		// socket, see which one has elapsed.
+		unsigned long now = now_msec();
+
+		if(throttle_deadline != 0 && now >= throttle_deadline)
+		{
+			// Buckets have been refilled, try again
+			io_condition cond = throttled;
+			throttled = IO_NONE;
+			throttle_deadline = 0;
+
+			if(cond & IO_INCOMING)
+				set_select(get_select() | IO_INCOMING);
+			if(cond & IO_OUTGOING)
+				select_outgoing();
+		}
+
+		if(flush_deadline != 0 && now >= flush_deadline)
+		{
+			// Give up waiting for the data to be sent or for the
+			// remote site to close the connection.
+			on_close();
+			return;
+		}
+
+		if(keepalive_deadline != 0 && now >= keepalive_deadline)
+		{
+			keepalive_deadline = 0;
+
+			if(keepalive == KEEPALIVE_ENABLED)
+			{
+				// Timer has elapsed: We have not got a packet
+				// since 60 seconds. Keepalive the connection.
+				net6::packet pack("net6_ping");
+				enqueue(pack);
+
+				// Wait for response
+				keepalive = KEEPALIVE_WAITING;
+				keepalive_deadline = now + KEEPALIVE_WAIT_TIME;
+			}
+			else if(keepalive == KEEPALIVE_WAITING)
+			{
+				// Did not get a response since 30 seconds
+				on_close();
+				return;
+			}
+		}
+
+		// The selector does not run a timer again after it elapsed
+		update_timer();
+	}
+
+	if(io & IO_ERROR)
+	{
+		on_close();
+	}
+}
+
+void net6::connection_base::handle_io_error(error::code code)
+{
+	// Try again when the socket is selected the next time. This may
+	// happen if users set sockets to non-blocking.
+	if(code == error::WOULD_BLOCK || code == error::INTERRUPTED)
+		return;
+
+	on_close();
+}
+
+void net6::connection_base::on_recv(const packet& pack)
+{
+	try
+	{
+		do_recv(pack);
+	}
+	catch(net6::bad_count& e)
+	{
+		std::cerr << "net6 warning: Protocol mismatch! Received bad "
+		          << "parameter count from " << remote_addr->get_name()
+		          << " in packet " << pack.get_command() << std::endl;
+	}
+	catch(net6::bad_format& e)
+	{
+		std::cerr << "net6 warning: Protocol mismatch! Received bad "
+		          << "parameter format from " << remote_addr->get_name()
+		          << " in packet " << pack.get_command() << ": "
+		          << e.what() << std::endl;
+	}
+	catch(net6::bad_value& e)
+	{
+		std::cerr << "net6 warning: Protocol mismatch! Received bad "
+		          << "parameter value from " << remote_addr->get_name()
+		          << " in packet " << pack.get_command() << ": "
+		          << e.what() << std::endl;
+	}
+}
+
+void net6::connection_base::do_recv(const packet& pack)
+{
+	if(pack.get_command() == "net6_encryption")
+		net_encryption(pack);
+	else if(pack.get_command() == "net6_encryption_ok")
+		net_encryption_ok(pack);
+	else if(pack.get_command() == "net6_encryption_failed")
+		net_encryption_failed(pack);
+	else if(pack.get_command() == "net6_encryption_begin")
+		net_encryption_begin(pack);
+	else if(pack.get_command() == "net6_compression")
+		net_compression(pack);
+	else if(pack.get_command() == "net6_compression_ok")
+		net_compression_ok(pack);
+	else if(pack.get_command() == "net6_compression_failed")
+		net_compression_failed(pack);
+	else if(pack.get_command() == "net6_ping")
+		net_ping(pack);
+	else if(pack.get_command() == "net6_pong")
+		; // no-op. Action is taken in do_io
+	else
+		signal_recv.emit(pack);
+}
+
+void net6::connection_base::finish_connect()
+{
+	try
+	{
+		remote_sock->finish_connect();
+	}
+	catch(net6::error& e)
+	{
+		reset();
+		signal_connect_failed.emit(e);
+		return;
+	}
+
+	state = UNENCRYPTED;
+
+	// Send what has been queued while connecting
+	io_condition cond = IO_ERROR | IO_INCOMING;
+	if(cork_count == 0 && has_outgoing_data() )
+		cond |= IO_OUTGOING;
+
+	set_select(cond);
+	if(keepalive == KEEPALIVE_ENABLED)
+		start_keepalive_timer();
+
+	// close_after_flush() may have been called while connecting
+	if(flush == FLUSH_PENDING)
+	{
+		update_timer();
+		check_flushed();
+	}
+
+	signal_connected.emit();
+}
+
+void net6::connection_base::check_flushed()
+{
+	if(flush != FLUSH_PENDING || state == CONNECTING)
+		return;
+
+	// Data behind a block is sent when encryption or compression has
+	// been negotiated.
+	if(has_outgoing_data() || has_scheduled_data() ||
+	   sendqueue.get_total_size() > 0)
+		return;
+
+	flush = FLUSH_SHUTDOWN;
+
+	try
+	{
+		remote_sock->shutdown_send();
+	}
+	catch(net6::error& e)
+	{
+		// The connection is broken already, the next read reports
+		// that.
+	}
+}
+
+void net6::connection_base::begin_handshake(tcp_encrypted_socket_base* sock)
+{
+	set_select(IO_NONE);
+
+	encrypted_sock = sock;
+	remote_sock.reset(encrypted_sock);
+	setup_signal();
+
+	state = ENCRYPTION_HANDSHAKING;
+	do_handshake();
+}
+
+void net6::connection_base::do_handshake()
+{
+	if(encrypted_sock == NULL)
+	{
+		throw std::logic_error(
+			"net6::connection_base::do_handshake:\n"
+			"No encrypted socket present"
+		);
+	}
+
+	if(state != ENCRYPTION_HANDSHAKING)
+	{
+		throw std::logic_error(
+			"net6::connection_base::do_handshake:\n"
+			"Invalid state"
+		);
+	}
+
+	if(encrypted_sock->handshake() )
+	{
+		// Done. Normal select
+		sendqueue.unblock();
+		io_condition flags = IO_INCOMING | IO_ERROR;
+		if(has_outgoing_data() ) flags |= IO_OUTGOING;
+
+		state = ENCRYPTED;
+		set_select(flags);
+
+		if(keepalive == KEEPALIVE_ENABLED)
+			start_keepalive_timer();
+
+		if(flush == FLUSH_PENDING)
+		{
+			update_timer();
+			check_flushed();
+		}
+
+		signal_encrypted.emit();
+
+#ifdef WIN32
+		// This is required to call recv as a re-enabling function
+		// for asynchronous selection. Note that we cannot just
+		// call encrypted_sock->recv here and expect WSAEWOULDBLOCK
+		// since real data might be in the buffer that a call could
+		// read and we should process.
+
+		// TODO: We should not do this when the
+		// socket is in blocking mode!
+		on_sock_event(IO_INCOMING);
+		if(has_outgoing_data() )
+			on_sock_event(IO_OUTGOING);
+#endif
+	}
+	else
+	{
+		io_condition flags = IO_ERROR;
+
+		// Select depending on current TLS direction
+		if(encrypted_sock->get_dir() )
+			set_select(flags | IO_OUTGOING);
+		else
+			set_select(flags | IO_INCOMING);
+	}
+}
+
+void net6::connection_base::on_send()
+{
+	if(state == ENCRYPTION_INITIATED_SERVER)
+	{
+		// All remaining data has been sent, we may now initiate the
+		// TLS handshake.
+		if(params == NULL)
+		{
+			begin_handshake(
+				new tcp_encrypted_socket_server(*remote_sock)
+			);
+		}
+		else
+		{
+			begin_handshake(
+				new tcp_encrypted_socket_server(
+					*remote_sock,
+					*params
+				)
+			);
+		}
+	}
+	else
+	{
+		// All available data has been sent, we need no longer to
+		// select for IO_OUTGOING
+		net6::io_condition flags = get_select();
+		if( (flags & IO_OUTGOING) == IO_OUTGOING)
+			set_select(flags & ~IO_OUTGOING);
+
+		check_flushed();
+		signal_send.emit();
+	}
+}
+
+void net6::connection_base::on_close()
+{
+	reset();
+	signal_close.emit();
+}
+
+void net6::connection_base::reset()
+{
+	state = CLOSED;
+
+	if(keepalive == KEEPALIVE_WAITING)
+		keepalive = KEEPALIVE_ENABLED;
+
+	compression = COMPRESSION_DISABLED;
+	zstream.reset();
+	sock_corked = false;
+
+	recv_size = MIN_RECV_SIZE;
+	recv_scanned = 0;
+
+	throttled = IO_NONE;
+	throttle_deadline = 0;
+	keepalive_deadline = 0;
+	keepalive_user_timeout = false;
+	outgoing_since = 0;
+
+	flush = FLUSH_NONE;
+	flush_deadline = 0;
+
+	stream_header.reset();
+	stream_raw = false;
+	stream_remaining = 0;
+
+	file_transfers.clear();
+	inlined_files.clear();
+
+	pending_sends.clear();
+	sendqueue_removed = 0;
+	wire_sent = 0;
+
+	for(unsigned int i = 0; i <= PRIORITY_BULK; ++ i)
+	{
+		priorities[i].data.clear();
+		priorities[i].packets.clear();
+		priorities[i].deficit = 0;
+	}
+
+	current_priority = PRIORITY_INTERACTIVE;
+
+	set_select(IO_NONE);
+	sendqueue.clear();
+	recvqueue.clear();
+	recvbuffer.clear();
+	wirequeue.clear();
+
+	// Must be done after the socket has been removed from the selector
+	orphan_zerocopy();
+	zerocopy = ZEROCOPY_UNKNOWN;
+	zerocopy_sends = 0;
+	zerocopy_completed = 0;
+
+	remote_sock.reset();
+	remote_addr.reset();
+	encrypted_sock = NULL;
+}
+
+void net6::connection_base::init_stats()
+{
+	stats = connection_stats();
+	outgoing_since = 0;
+}
+
+void net6::connection_base::setup_signal()
+{
+	remote_sock->io_event().connect(
+		sigc::mem_fun(*this, &connection_base::on_sock_event) );
+}
+
+void net6::connection_base::select_outgoing()
+{
+	if(cork_count == 0 && (throttled & IO_OUTGOING) == IO_NONE &&
+	   has_outgoing_data() )
+	{
+		io_condition flags = get_select();
+		if( (flags & IO_OUTGOING) == 0)
+		{
+			set_select(flags | IO_OUTGOING);
+			outgoing_since = now_msec();
+		}
+	}
+
+	// Packets waiting in the priority queues count as well
+	queue::size_type size = sendqueue.get_total_size();
+	for(unsigned int i = 0; i <= PRIORITY_BULK; ++ i)
+		size += priorities[i].data.get_size();
+
+	if(size > stats.peak_sendqueue)
+		stats.peak_sendqueue = size;
+}
+
+bool net6::connection_base::has_outgoing_data() const
+{
+	// Scheduled packets are held back while the send queue is blocked
+	return has_zerocopy_data() || !file_transfers.empty() ||
+		wirequeue.get_size() > 0 || sendqueue.get_size() > 0 ||
+		(has_scheduled_data() && !sendqueue.is_blocked() );
+}
+
+bool net6::connection_base::begin_zerocopy(queue& outqueue)
+{
+	// A blocked queue cannot be handed over as a whole
+	// Data queued behind a pending file must not be handed over
+	if(zerocopy_threshold == 0 || encrypted_sock != NULL ||
+	   !file_transfers.empty() ||
+	   outqueue.get_size() < zerocopy_threshold ||
+	   outqueue.get_size() != outqueue.get_total_size() )
+		return false;
+
+	if(zerocopy == ZEROCOPY_UNKNOWN)
+	{
+		zerocopy = remote_sock->set_zerocopy(true) ?
+			ZEROCOPY_AVAILABLE : ZEROCOPY_UNAVAILABLE;
+	}
+
+	if(zerocopy != ZEROCOPY_AVAILABLE)
+		return false;
+
+	// Take over the memory of the queue, it must not be touched
+	// until the kernel is done with it.
+	zerocopy_segment segment;
+	segment.data.reset(new queue);
+	segment.data->swap(outqueue);
+	segment.sent = 0;
+	segment.last_send = zerocopy_sends;
+
+	zerocopy_segments.push_back(std::move(segment) );
+
+	if(&outqueue == &sendqueue)
+		move_pending_sends(zerocopy_segments.back().data->get_size() );
+
+	return true;
+}
+
+void net6::connection_base::add_pending_send(unsigned long token)
+{
+	// Files that are not yet in the send queue are sent before
+	uint64_t end = sendqueue_removed + sendqueue.get_total_size();
+	for(std::deque<file_transfer>::const_iterator iter =
+		file_transfers.begin();
+	    iter != file_transfers.end();
+	    ++ iter)
+	{
+		end += iter->remaining;
+	}
+
+	pending_send pending = { token, end, false };
+	pending_sends.push_back(pending);
+}
+
+void net6::connection_base::enqueue(const packet& pack)
+{
+	// Replies to the remote site cannot be sent anymore
+	if(flush == FLUSH_SHUTDOWN) return;
+
+	pack.enqueue(sendqueue);
+	++ stats.packets_out;
+	select_outgoing();
+}
+
+void net6::connection_base::enqueue_unblocked(const packet& pack)
+{
+	// Replies to the remote site cannot be sent anymore
+	if(flush == FLUSH_SHUTDOWN) return;
+
+	queue data;
+	pack.enqueue(data);
+
+	// Packets behind the block are sent after the new one. Files are
+	// never queued behind a block.
+	uint64_t block_end = sendqueue_removed + sendqueue.get_size();
+	for(std::deque<file_transfer>::const_iterator iter =
+		file_transfers.begin();
+	    iter != file_transfers.end();
+	    ++ iter)
+	{
+		block_end += iter->remaining;
+	}
+
+	for(std::deque<pending_send>::iterator iter = pending_sends.begin();
+	    iter != pending_sends.end();
+	    ++ iter)
+	{
+		if(!iter->on_wire && iter->end > block_end)
+			iter->end += data.get_size();
+	}
+
+	sendqueue.append_unblocked(data.get_data(), data.get_size() );
+	++ stats.packets_out;
+	select_outgoing();
+}
+
+void net6::connection_base::enqueue(const packet& pack,
+                                    send_priority priority,
+                                    bool has_token,
+                                    unsigned long token)
+{
+	if(state == CLOSED)
+	{
+		throw std::logic_error(
+			"net6::connection_base::send:\n"
+			"Connection is closed"
+		);
+	}
+
+	if(flush != FLUSH_NONE)
+	{
+		throw std::logic_error(
+			"net6::connection_base::send:\n"
+			"Connection is being closed"
+		);
+	}
+
+	if(!has_scheduled_data() && sendqueue.get_total_size() <
+	   std::max(SCHEDULE_SIZE, zerocopy_threshold) )
+	{
+		// Nothing to schedule, schedule() would move the packet to
+		// the send queue right away.
+		pack.enqueue(sendqueue);
+		if(has_token) add_pending_send(token);
+	}
+	else
+	{
+		priority_queue& prio = priorities[priority];
+		queue::size_type prev_size = prio.data.get_size();
+		pack.enqueue(prio.data);
+
+		scheduled_packet scheduled = {
+			prio.data.get_size() - prev_size,
+			(max_starvation > 0) ? now_msec() : 0,
+			has_token,
+			token
+		};
+
+		prio.packets.push_back(scheduled);
+	}
+
+	++ stats.packets_out;
+	select_outgoing();
+}
+
+bool net6::connection_base::has_scheduled_data() const
+{
+	for(unsigned int i = 0; i <= PRIORITY_BULK; ++ i)
+		if(!priorities[i].packets.empty() )
+			return true;
+
+	return false;
+}
+
+void net6::connection_base::schedule()
+{
+	// Moved packets would only be held back behind the block
+	if(sendqueue.is_blocked() ) return;
+
+	// Keep enough data in the send queue for zero-copy sending
+	queue::size_type size = std::max(SCHEDULE_SIZE, zerocopy_threshold);
+	while(sendqueue.get_total_size() < size)
+	{
+		int next = next_priority();
+		if(next < 0) break;
+
+		schedule_packet(priorities[next]);
+	}
+}
+
+void net6::connection_base::schedule_all(send_priority priority)
+{
+	while(!priorities[priority].packets.empty() )
+		schedule_packet(priorities[priority]);
+}
+
+void net6::connection_base::schedule_packet(priority_queue& prio)
+{
+	scheduled_packet scheduled = prio.packets.front();
+	prio.packets.pop_front();
+
+	sendqueue.append(prio.data.get_data(), scheduled.size);
+	prio.data.remove(scheduled.size);
+
+	if(scheduled.has_token)
+		add_pending_send(scheduled.token);
+}
+
+int net6::connection_base::next_priority()
+{
+	bool waiting = false;
+	for(unsigned int i = 0; i <= PRIORITY_BULK; ++ i)
+	{
+		if(priorities[i].packets.empty() )
+			priorities[i].deficit = 0;
+		else
+			waiting = true;
+	}
+
+	if(!waiting) return -1;
+
+	// A packet that has waited too long goes first. Lower priorities
+	// are checked first since they are the ones likely to starve.
+	if(max_starvation > 0)
+	{
+		unsigned long now = now_msec();
+		for(int i = PRIORITY_BULK; i >= 0; -- i)
+		{
+			const priority_queue& prio = priorities[i];
+			if(!prio.packets.empty() &&
+			   now - prio.packets.front().queued_at >= max_starvation)
+				return i;
+		}
+	}
+
+	// Deficit round robin: Each priority in turn may send as much
+	// data as its weight allows, the remainder is kept for its next
+	// turn.
+	while(true)
+	{
+		priority_queue& prio = priorities[current_priority];
+		if(!prio.packets.empty() &&
+		   prio.deficit >= prio.packets.front().size)
+		{
+			prio.deficit -= prio.packets.front().size;
+			return current_priority;
+		}
+
+		current_priority = (current_priority + 1) % (PRIORITY_BULK + 1);
+
+		priority_queue& next = priorities[current_priority];
+		if(!next.packets.empty() )
+			next.deficit += next.weight * PRIORITY_QUANTUM;
+	}
+}
+
+void net6::connection_base::move_pending_sends(queue::size_type len)
+{
+	sendqueue_removed += len;
+
+	// The moved data is now at the end of the data still to be
+	// written to the socket.
+	uint64_t end = wire_sent + wirequeue.get_size();
+	if(has_zerocopy_data() )
+	{
+		const zerocopy_segment& segment = zerocopy_segments.back();
+		end += segment.data->get_size() - segment.sent;
+	}
+
+	for(std::deque<pending_send>::iterator iter = pending_sends.begin();
+	    iter != pending_sends.end();
+	    ++ iter)
+	{
+		if(iter->on_wire) continue;
+		if(iter->end > sendqueue_removed) break;
+
+		iter->on_wire = true;
+		iter->end = end;
+	}
+}
+
+bool net6::connection_base::has_zerocopy_data() const
+{
+	if(zerocopy_segments.empty() ) return false;
+
+	const zerocopy_segment& segment = zerocopy_segments.back();
+	return segment.sent < segment.data->get_size();
+}
+
+void net6::connection_base::release_zerocopy()
+{
+	if(!zerocopy_orphans.empty() )
+		release_zerocopy_orphans();
+
+	zerocopy_completed += remote_sock->read_zerocopy_completions();
+
+	while(!zerocopy_segments.empty() )
+	{
+		const zerocopy_segment& segment = zerocopy_segments.front();
+		if(segment.sent < segment.data->get_size() ||
+		   segment.last_send > zerocopy_completed)
+			break;
+
+		zerocopy_segments.pop_front();
+	}
+}
+
+void net6::connection_base::orphan_zerocopy()
+{
+	// The kernel may still read from data it has not reported as
+	// sent yet, so that memory must not be reused before. The socket
+	// is kept open until then, but the remote site sees the
+	// connection closed.
+	release_zerocopy_orphans();
+	if(zerocopy_segments.empty() ) return;
+
+	try
+	{
+		zerocopy_completed +=
+			remote_sock->read_zerocopy_completions();
+	}
+	catch(net6::error& e)
+	{
+		zerocopy_completed = zerocopy_sends;
+	}
+
+	if(zerocopy_completed < zerocopy_sends)
 	{
-		if(keepalive == KEEPALIVE_ENABLED)
+		zerocopy_orphan orphan;
+		orphan.sends = zerocopy_sends;
+		orphan.completed = zerocopy_completed;
+
+		for(std::deque<zerocopy_segment>::iterator iter =
+			zerocopy_segments.begin();
+		    iter != zerocopy_segments.end();
+		    ++ iter)
 		{
-			// Timer has elapsed: We have not got a packet since
-			// 60 seconds. Keepalive the connection.
-			net6::packet pack("net6_ping");
-			send(pack);
+			orphan.data.push_back(std::move(iter->data) );
+		}
 
-			// Wait for response
-			keepalive = KEEPALIVE_WAITING;
-			set_timeout(KEEPALIVE_WAIT_TIME);
+		try
+		{
+			remote_sock->tcp_client_socket::shutdown_send();
 		}
-		else if(keepalive == KEEPALIVE_WAITING)
+		catch(net6::error& e)
 		{
-			// Did not get a response since 30 seconds
-			on_close();
+			// Already closed by the remote site
 		}
-	}
 
-	if(io & IO_ERROR)
-	{
-		on_close();
+		orphan.sock = std::move(remote_sock);
+		zerocopy_orphans.push_back(std::move(orphan) );
 	}
+
+	zerocopy_segments.clear();
 }
 
-void net6::connection_base::on_recv(const packet& pack)
+void net6::connection_base::begin_compression()
 {
-	try
+	// Data that has been queued up to now is sent uncompressed
+	queue::size_type len = sendqueue.get_size();
+	wirequeue.append(sendqueue.get_data(), len);
+	sendqueue.remove(len);
+	sendqueue.unblock();
+	move_pending_sends(len);
+
+	zstream.reset(new deflate_stream);
+	compression = COMPRESSION_ENABLED;
+
+	// The remote site compresses everything it sent after the packet
+	// that triggered this call. We may already have received some
+	// of it, do_io() decompresses it.
+	if(recvqueue.get_size() > 0)
 	{
-		do_recv(pack);
+		recvbuffer.append(recvqueue.get_data(), recvqueue.get_size() );
+		recvqueue.remove(recvqueue.get_size() );
+		recv_scanned = 0;
 	}
-	catch(net6::bad_count& e)
+
+	select_outgoing();
+}
+
+bool net6::connection_base::inflate_received()
+{
+	if(compression != COMPRESSION_ENABLED || recvbuffer.get_size() == 0)
+		return false;
+
+	queue::size_type used = zstream->inflate(
+		recvbuffer.get_data(),
+		recvbuffer.get_size(),
+		recvqueue,
+		recvqueue.get_size() + INFLATE_SIZE
+	);
+
+	recvbuffer.remove(used);
+
+	if(recvqueue.get_size() > stats.peak_recvqueue)
+		stats.peak_recvqueue = recvqueue.get_size();
+
+	return true;
+}
+
+bool net6::connection_base::begin_stream()
+{
+	// Parameters before the last separator are complete and form the
+	// header of the streamed packet.
+	const char* data = recvqueue.get_data();
+	const char* end = data + recvqueue.get_size();
+	const char* last = end;
+
+	while(last != data && *(last - 1) != ':')
+		-- last;
+
+	// The command itself is too large, this cannot be streamed
+	if(last == data)
+		return false;
+
+	queue header;
+	header.append(data, last - data - 1);
+	header.append("\n", 1);
+
+	stream_header = std::make_shared<packet>(header);
+	stream_index = stream_header->get_param_count();
+
+	recvqueue.remove(last - data);
+	recv_scanned = 0;
+	return true;
+}
+
+bool net6::connection_base::begin_file(const packet& pack)
+{
+	if(pack.get_param_count() < 2)
 	{
 		std::cerr << "net6 warning: Protocol mismatch! Received bad "
 		          << "parameter count from " << remote_addr->get_name()
 		          << " in packet " << pack.get_command() << std::endl;
+		return false;
 	}
-	catch(net6::bad_format& e)
+
+	queue::size_type len;
+	try
 	{
-		std::cerr << "net6 warning: Protocol mismatch! Received bad "
-		          << "parameter format from " << remote_addr->get_name()
-		          << " in packet " << pack.get_command() << ": "
-		          << e.what() << std::endl;
+		len = pack.get_param(0).as<queue::size_type>();
 	}
-	catch(net6::bad_value& e)
+	catch(net6::bad_format& e)
 	{
 		std::cerr << "net6 warning: Protocol mismatch! Received bad "
-		          << "parameter value from " << remote_addr->get_name()
+		          << "parameter format from " << remote_addr->get_name()
 		          << " in packet " << pack.get_command() << ": "
 		          << e.what() << std::endl;
+		return false;
 	}
-}
 
-void net6::connection_base::do_recv(const packet& pack)
-{
-	if(pack.get_command() == "net6_encryption")
-		net_encryption(pack);
-	else if(pack.get_command() == "net6_encryption_ok")
-		net_encryption_ok(pack);
-	else if(pack.get_command() == "net6_encryption_failed")
-		net_encryption_failed(pack);
-	else if(pack.get_command() == "net6_encryption_begin")
-		net_encryption_begin(pack);
-	else if(pack.get_command() == "net6_ping")
-		net_ping(pack);
-	else if(pack.get_command() == "net6_pong")
-		; // no-op. Action is taken in do_io
-	else
-		signal_recv.emit(pack);
+	std::shared_ptr<packet> header = std::make_shared<packet>(
+		pack.get_param(1).as<std::string>(),
+		pack.get_param_count() - 2
+	);
+
+	for(unsigned int i = 2; i < pack.get_param_count(); ++ i)
+		header->params.push_back(pack.get_param(i) );
+
+	stream_header = header;
+	stream_index = header->get_param_count();
+	stream_raw = true;
+	stream_remaining = len;
+	return true;
 }
 
-void net6::connection_base::begin_handshake(tcp_encrypted_socket_base* sock)
+void net6::connection_base::inline_files()
 {
-	set_select(IO_NONE);
+	if(file_transfers.empty() ) return;
 
-	encrypted_sock = sock;
-	remote_sock.reset(encrypted_sock);
-	setup_signal();
+	// Read the remainder of the files into the send queue at the
+	// positions they would have been sent at.
+	queue merged;
+	queue::size_type pos = 0;
 
-	state = ENCRYPTION_HANDSHAKING;
-	do_handshake();
+	for(std::deque<file_transfer>::const_iterator iter =
+		file_transfers.begin();
+	    iter != file_transfers.end();
+	    ++ iter)
+	{
+		merged.append(sendqueue.get_data() + pos, iter->position - pos);
+		read_file(merged, iter->fd, iter->offset, iter->remaining);
+		pos = iter->position;
+	}
+
+	merged.append(sendqueue.get_data() + pos, sendqueue.get_size() - pos);
+	sendqueue.swap(merged);
+
+	// file_progress_event is emitted by do_io()
+	inlined_files.insert(
+		inlined_files.end(),
+		file_transfers.begin(),
+		file_transfers.end()
+	);
+
+	file_transfers.clear();
 }
 
-void net6::connection_base::do_handshake()
+bool net6::connection_base::stream_received(std::string& data,
+                                            chunk_position& position)
 {
-	if(encrypted_sock == NULL)
+	if(stream_raw)
 	{
-		throw std::logic_error(
-			"net6::connection_base::do_handshake:\n"
-			"No encrypted socket present"
-		);
-	}
+		queue::size_type len =
+			std::min(stream_remaining, recvqueue.get_size() );
 
-	if(state != ENCRYPTION_HANDSHAKING)
-	{
-		throw std::logic_error(
-			"net6::connection_base::do_handshake:\n"
-			"Invalid state"
-		);
-	}
+		if(len == 0 && stream_remaining > 0)
+			return false;
 
-	if(encrypted_sock->handshake() )
-	{
-		// Done. Normal select
-		sendqueue.unblock();
-		io_condition flags = IO_INCOMING | IO_ERROR;
-		if(sendqueue.get_size() > 0) flags |= IO_OUTGOING;
+		data.assign(recvqueue.get_data(), len);
+		recvqueue.remove(len);
+		stream_remaining -= len;
 
-		state = ENCRYPTED;
-		set_select(flags);
+		if(stream_remaining > 0)
+		{
+			position = CHUNK_PARTIAL;
+		}
+		else
+		{
+			position = CHUNK_FRAME_END;
+			stream_raw = false;
+		}
 
-		if(keepalive == KEEPALIVE_ENABLED)
-			start_keepalive_timer();
+		return true;
+	}
 
-		signal_encrypted.emit();
+	const char* begin = recvqueue.get_data();
+	const char* end = begin + recvqueue.get_size();
 
-#ifdef WIN32
-		// This is required to call recv as a re-enabling function
-		// for asynchronous selection. Note that we cannot just
-		// call encrypted_sock->recv here and expect WSAEWOULDBLOCK
-		// since real data might be in the buffer that a call could
-		// read and we should process.
+	const char* pos = begin;
+	while(pos != end && *pos != ':' && *pos != '\n')
+		++ pos;
 
-		// TODO: We should not do this when the
-		// socket is in blocking mode!
-		on_sock_event(IO_INCOMING);
-		if(sendqueue.get_size() > 0)
-			on_sock_event(IO_OUTGOING);
-#endif
+	queue::size_type len = pos - begin;
+	if(pos == end)
+	{
+		// Keep an incomplete escape sequence for the next chunk
+		if(len > 0 && *(pos - 1) == '\\')
+			-- len;
+
+		if(len == 0)
+			return false;
+
+		position = CHUNK_PARTIAL;
 	}
 	else
 	{
-		io_condition flags = IO_ERROR;
-
-		// Select depending on current TLS direction
-		if(encrypted_sock->get_dir() )
-			set_select(flags | IO_OUTGOING);
-		else
-			set_select(flags | IO_INCOMING);
+		position = (*pos == ':') ? CHUNK_PARAM_END : CHUNK_FRAME_END;
 	}
+
+	data = packet::unescape(begin, begin + len);
+	recvqueue.remove(position == CHUNK_PARTIAL ? len : len + 1);
+
+	if(position == CHUNK_PARAM_END)
+		++ stream_index;
+
+	return true;
 }
 
-void net6::connection_base::on_send()
+void net6::connection_base::start_keepalive_timer()
 {
-	if(state == ENCRYPTION_INITIATED_SERVER)
+	if(flush != FLUSH_NONE) return;
+
+	keepalive_deadline = now_msec() + KEEPALIVE_INTERVAL_TIME;
+	update_timer();
+}
+
+void net6::connection_base::stop_keepalive_timer()
+{
+	keepalive_deadline = 0;
+	update_timer();
+
+	// Wait no longer for a reply
+	if(keepalive == KEEPALIVE_WAITING)
+		keepalive = KEEPALIVE_ENABLED;
+}
+
+void net6::connection_base::set_kernel_keepalive(bool enable)
+{
+	// Probe as the keepalive packets would, and give up on data that
+	// is not acknowledged within the same time.
+	const unsigned long interval =
+		KEEPALIVE_WAIT_TIME / KEEPALIVE_PROBE_COUNT;
+
+	if(remote_sock->set_keepalive(enable,
+	                              KEEPALIVE_INTERVAL_TIME,
+	                              interval,
+	                              KEEPALIVE_PROBE_COUNT) )
 	{
-		// All remaining data has been sent, we may now initiate the
-		// TLS handshake.
-		if(params == NULL)
+		// Keep a timeout configured with tcp_options
+		if(enable && !keepalive_user_timeout &&
+		   remote_sock->get_user_timeout() == 0)
 		{
-			begin_handshake(
-				new tcp_encrypted_socket_server(*remote_sock)
+			keepalive_user_timeout = remote_sock->set_user_timeout(
+				KEEPALIVE_INTERVAL_TIME + KEEPALIVE_WAIT_TIME
 			);
 		}
-		else
+		else if(!enable && keepalive_user_timeout)
 		{
-			begin_handshake(
-				new tcp_encrypted_socket_server(
-					*remote_sock,
-					*params
-				)
-			);
+			remote_sock->set_user_timeout(0);
+			keepalive_user_timeout = false;
 		}
 	}
-	else
+	else if(enable)
 	{
-		// All available data has been sent, we need no longer to
-		// select for IO_OUTGOING
-		net6::io_condition flags = get_select();
-		if( (flags & IO_OUTGOING) == IO_OUTGOING)
-			set_select(flags & ~IO_OUTGOING);
+		// Not a TCP socket, fall back to keepalive packets
+		keepalive = KEEPALIVE_ENABLED;
+		if(state == UNENCRYPTED || state == ENCRYPTED)
+			start_keepalive_timer();
+	}
+}
 
-		signal_send.emit();
+void net6::connection_base::update_timer()
+{
+	if(state == CLOSED) return;
+
+	unsigned long deadline = keepalive_deadline;
+	if(throttle_deadline != 0 &&
+	   (deadline == 0 || throttle_deadline < deadline) )
+		deadline = throttle_deadline;
+	if(flush_deadline != 0 &&
+	   (deadline == 0 || flush_deadline < deadline) )
+		deadline = flush_deadline;
+
+	if(deadline == 0)
+	{
+		io_condition flags = get_select();
+		if( (flags & IO_TIMEOUT) == IO_TIMEOUT)
+			set_select(flags & ~IO_TIMEOUT);
+	}
+	else
+	{
+		// A timeout of zero would not elapse at all
+		unsigned long now = now_msec();
+		set_timeout(deadline > now ? deadline - now : 1);
 	}
 }
 
-void net6::connection_base::on_close()
+net6::queue::size_type net6::connection_base::get_allowance(io_condition cond)
 {
-	state = CLOSED;
+	token_bucket& limit = (cond == IO_INCOMING) ? recv_limit : send_limit;
+	token_bucket* shared = (cond == IO_INCOMING) ?
+		shared_recv_limit : shared_send_limit;
 
-	if(keepalive == KEEPALIVE_WAITING)
-		keepalive = KEEPALIVE_ENABLED;
+	queue::size_type allowed = get_tokens(limit);
+	if(shared != NULL)
+		allowed = std::min(allowed, get_tokens(*shared) );
 
-	set_select(IO_NONE);
-	sendqueue.clear();
-	recvqueue.clear();
+	if(allowed > 0)
+		return allowed;
 
-	remote_sock.reset(NULL);
-	remote_addr.reset(NULL);
-	encrypted_sock = NULL;
+	unsigned long wait = limit.get_wait_time(MIN_RECV_SIZE);
+	if(shared != NULL)
+		wait = std::max(wait, shared->get_wait_time(MIN_RECV_SIZE) );
 
-	signal_close.emit();
-}
+	throttled |= cond;
+	if(cond == IO_OUTGOING) outgoing_since = 0;
 
-void net6::connection_base::setup_signal()
-{
-	remote_sock->io_event().connect(
-		sigc::mem_fun(*this, &connection_base::on_sock_event) );
-}
+	io_condition flags = get_select();
+	if(flags & cond)
+		set_select(flags & ~cond);
 
-void net6::connection_base::start_keepalive_timer()
-{
-	/*io_condition flags = get_select();
-	if( (flags & IO_TIMEOUT) == IO_NONE)
-		set_select(flags | IO_TIMEOUT);*/
+	unsigned long deadline = now_msec() + wait;
+	if(throttle_deadline == 0 || deadline < throttle_deadline)
+		throttle_deadline = deadline;
 
-	set_timeout(KEEPALIVE_INTERVAL_TIME);
+	update_timer();
+	return 0;
 }
 
-void net6::connection_base::stop_keepalive_timer()
+void net6::connection_base::consume_tokens(io_condition cond,
+                                           queue::size_type amount)
 {
-	io_condition flags = get_select();
-	if( (flags & IO_TIMEOUT) == IO_TIMEOUT)
-		set_select(flags & ~IO_TIMEOUT);
-
-	// Wait no longer for a reply
-	if(keepalive == KEEPALIVE_WAITING)
-		keepalive = KEEPALIVE_ENABLED;
+	if(cond == IO_INCOMING)
+	{
+		recv_limit.consume(amount);
+		if(shared_recv_limit != NULL)
+			shared_recv_limit->consume(amount);
+	}
+	else
+	{
+		send_limit.consume(amount);
+		if(shared_send_limit != NULL)
+			shared_send_limit->consume(amount);
+	}
 }
 
 void net6::connection_base::net_encryption(const packet& pack)
@@ -610,9 +2503,20 @@ void net6::connection_base::net_encryption(const packet& pack)
 		);
 	}
 
+	// We cannot block the send queue for the TLS handshake while
+	// waiting for the reply to our compression request.
+	if(compression == COMPRESSION_REQUESTED)
+	{
+		// Our request blocked the send queue, the reply must not
+		// wait for the answer to it.
+		packet reply("net6_encryption_failed");
+		enqueue_unblocked(reply);
+		return;
+	}
+
 	// Received encryption request
 	packet reply("net6_encryption_ok");
-	send(reply);
+	enqueue(reply);
 
 	// Block further packets in order to perform a TLS handshake. This
 	// is done in on_send(), when all remaining data has been sent.
@@ -666,6 +2570,23 @@ void net6::connection_base::net_encryption_ok(const packet& pack)
 		// a packet, just enqueue it.
 		sendqueue.prepend("net6_encryption_begin\n", 22);
 
+		// Packets and files in the queue are sent after it
+		for(std::deque<pending_send>::iterator iter =
+			pending_sends.begin();
+		    iter != pending_sends.end();
+		    ++ iter)
+		{
+			if(!iter->on_wire) iter->end += 22;
+		}
+
+		for(std::deque<file_transfer>::iterator iter =
+			file_transfers.begin();
+		    iter != file_transfers.end();
+		    ++ iter)
+		{
+			iter->position += 22;
+		}
+
 		io_condition flags = get_select();
 		if( (flags & IO_OUTGOING) == 0)
 			set_select(flags | IO_OUTGOING);
@@ -689,12 +2610,18 @@ void net6::connection_base::net_encryption_failed(const packet& pack)
 	state = UNENCRYPTED;
 
 	net6::io_condition flags = net6::IO_INCOMING | net6::IO_ERROR;
-	if(sendqueue.get_size() > 0) flags |= net6::IO_OUTGOING;
+	if(has_outgoing_data() ) flags |= net6::IO_OUTGOING;
 	set_select(flags);
 
 	if(keepalive == KEEPALIVE_ENABLED)
 		start_keepalive_timer();
 
+	if(flush == FLUSH_PENDING)
+	{
+		update_timer();
+		check_flushed();
+	}
+
 	signal_encryption_failed.emit();
 }
 
@@ -711,8 +2638,78 @@ void net6::connection_base::net_encryption_begin(const packet& pack)
 	begin_handshake(new tcp_encrypted_socket_client(*remote_sock));
 }
 
+void net6::connection_base::net_compression(const packet& pack)
+{
+	// Deny if we requested compression ourselves or if the send queue
+	// is blocked because encryption is being negotiated.
+	if(compression != COMPRESSION_DISABLED ||
+	   (state != UNENCRYPTED && state != ENCRYPTED) )
+	{
+		// The send queue is blocked by our own request, the
+		// reply must not wait for the answer to it.
+		packet reply("net6_compression_failed");
+		enqueue_unblocked(reply);
+		return;
+	}
+
+	// Files cannot be passed to the socket anymore once the traffic
+	// is compressed. Files queued before a compression request of our
+	// own have been sent completely when the reply arrives.
+	inline_files();
+
+	packet reply("net6_compression_ok");
+	enqueue(reply);
+
+	// compressed_event is emitted by do_io()
+	begin_compression();
+}
+
+void net6::connection_base::net_compression_ok(const packet& pack)
+{
+	if(compression != COMPRESSION_REQUESTED)
+	{
+		throw bad_value(
+			"Received compression reply without having "
+			"requested compression"
+		);
+	}
+
+	// compressed_event is emitted by do_io()
+	begin_compression();
+	check_flushed();
+}
+
+void net6::connection_base::net_compression_failed(const packet& pack)
+{
+	if(compression != COMPRESSION_REQUESTED)
+	{
+		throw bad_value(
+			"Received compression reply without having "
+			"requested compression"
+		);
+	}
+
+	sendqueue.unblock();
+	compression = COMPRESSION_DISABLED;
+	select_outgoing();
+	check_flushed();
+
+	signal_compression_failed.emit();
+}
+
 void net6::connection_base::net_ping(const packet& pack)
 {
 	net6::packet reply("net6_pong");
-	send(reply);
+	enqueue(reply);
+}
+
+net6::scoped_cork::scoped_cork(connection_base& conn):
+	conn(conn)
+{
+	conn.cork();
+}
+
+net6::scoped_cork::~scoped_cork()
+{
+	conn.uncork();
 }
@@ -105,12 +105,13 @@ namespace
 	template<
 		typename buffer_type,
 		ssize_t(*func)(net6::gnutls_session_t, buffer_type, size_t)
-	> io_size_type io_impl(const net6::gnutls_session_t session,
-	                       buffer_type buf,
-	                       io_size_type len,
-	                       io_handshake_state state)
+	> net6::error::code io_impl(const net6::gnutls_session_t session,
+	                            buffer_type buf,
+	                            io_size_type len,
+	                            io_size_type& done,
+	                            io_handshake_state state)
 	{
-		ssize_t ret;
+		ssize_t ret = 0;
 		switch(state)
 		{
 		case net6::tcp_encrypted_socket_base::DEFAULT:
@@ -133,12 +134,18 @@ namespace
 				func(session, NULL, 0);
 
 			if(ret < 0)
-				throw net6::error(net6::error::GNUTLS, ret);
+			{
+				return net6::error::translate(
+					net6::error::GNUTLS,
+					ret
+				);
+			}
 
 			break;
 		}
 
-		return ret;
+		done = ret;
+		return net6::error::NONE;
 	}
 }
 
@@ -287,22 +294,36 @@ net6::tcp_encrypted_socket_base::get_pending() const
 	return gnutls_record_check_pending(session);
 }
 
-net6::tcp_encrypted_socket_base::size_type
-net6::tcp_encrypted_socket_base::send(const void* buf, size_type len) const
+net6::error::code
+net6::tcp_encrypted_socket_base::try_send(const void* buf,
+                                          size_type len,
+                                          size_type& sent) const
 {
 	return ::io_impl<const void*, gnutls_record_send>(
-		session, buf, len, state
+		session, buf, len, sent, state
 	);
 }
 
-net6::tcp_encrypted_socket_base::size_type
-net6::tcp_encrypted_socket_base::recv(void* buf, size_type len) const
+net6::error::code
+net6::tcp_encrypted_socket_base::try_recv(void* buf,
+                                          size_type len,
+                                          size_type& received) const
 {
 	return ::io_impl<void*, gnutls_record_recv>(
-		session, buf, len, state
+		session, buf, len, received, state
 	);
 }
 
+void net6::tcp_encrypted_socket_base::shutdown_send() const
+{
+	// The remote site can then tell the end of the data from a
+	// truncation attack.
+	if(state == HANDSHAKED)
+		gnutls_bye(session, GNUTLS_SHUT_WR);
+
+	tcp_client_socket::shutdown_send();
+}
+
 net6::tcp_encrypted_socket_client::
 	tcp_encrypted_socket_client(tcp_client_socket& sock):
 	tcp_encrypted_socket_base(sock.cobj(), create_session(GNUTLS_CLIENT) )
@@ -526,6 +526,8 @@ namespace
 			         "was received.");
 		case net6::error::UNKNOWN:
 			return _("A nonrecoverable error has occured");
+		case net6::error::NONE:
+			return _("Success");
 		default:
 			throw std::logic_error(
 				"net6_strerror:\n"
@@ -578,3 +580,13 @@ net6::error::code net6::error::get_code() const
 	return errcode;
 }
 
+net6::error::code net6::error::translate(domain error_domain, int error_code)
+{
+	return domain_to_net6(error_domain, error_code);
+}
+
+net6::error::code net6::error::translate(domain error_domain)
+{
+	return domain_to_net6(error_domain, last_error(error_domain) );
+}
+
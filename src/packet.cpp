@@ -16,6 +16,9 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <algorithm>
+#include <utility>
+
 #include "packet.hpp"
 #include "connection.hpp"
 
@@ -24,6 +27,11 @@ net6::parameter::parameter(const std::string& value):
 {
 }
 
+net6::parameter::parameter(std::string&& value):
+	m_value(std::move(value) )
+{
+}
+
 const std::string& net6::parameter::serialised() const
 {
 	return m_value.serialised();
@@ -31,42 +39,27 @@ const std::string& net6::parameter::serialised() const
 
 net6::packet::packet(const std::string& command,
                      unsigned int size):
-	command(command)
+	command(command), indexed(true)
 {
 	params.reserve(size);
 }
 
-net6::packet::packet(queue& queue)
+net6::packet::packet(queue& queue):
+	indexed(false)
 {
 	// Check for a complete packet on the queue
 	net6::queue::size_type pack_pos = queue.packet_size();
 	if(pack_pos == queue.get_size() )
 		throw end_of_queue();
 
-	// Get packet string representation
-	std::string pack_string(queue.get_data(), pack_pos);
+	// Keep the escaped packet, parameters are split on demand
+	frame.assign(queue.get_data(), pack_pos);
 	queue.remove(pack_pos + 1);
 
 	// Find command
-	std::string::size_type pos = pack_string.find(':');
-	if(pos == std::string::npos) pos = pack_string.length();
-	command = unescape(pack_string.substr(0, pos) );
-
-	// Parameters
-	std::string::size_type prev = ++ pos;
-	while( (pos = pack_string.find(':', pos)) != std::string::npos)
-	{
-		std::string::size_type len = pos - prev;
-		params.push_back(
-			parameter(unescape(pack_string.substr(prev, len)))
-		);
-
-		prev = ++ pos;
-	}
-
-	// Last one
-	if(prev <= pack_string.length() )
-		params.push_back(parameter(unescape(pack_string.substr(prev))));
+	std::string::size_type pos = frame.find(':');
+	if(pos == std::string::npos) pos = frame.length();
+	command = unescape(frame.data(), frame.data() + pos);
 }
 
 const std::string& net6::packet::get_command() const
@@ -76,39 +69,118 @@ const std::string& net6::packet::get_command() const
 
 const net6::parameter& net6::packet::get_param(unsigned int index) const
 {
+	index_params();
+
 	if(index >= params.size() )
 		throw bad_count();
 
+	if(index < decoded.size() && !decoded[index])
+	{
+		// Unescape the parameter now that it is requested
+		const char* data = frame.data();
+		params[index] = parameter(
+			unescape(data + fields[index], data + fields[index + 1] - 1)
+		);
+
+		decoded[index] = true;
+	}
+
 	return params[index];
 }
 
 unsigned int net6::packet::get_param_count() const
 {
+	index_params();
 	return static_cast<unsigned int>(params.size() );
 }
 
 void net6::packet::enqueue(queue& queue) const
 {
+	// Received parameters need to be indexed to be forwarded
+	index_params();
+
+	// Reserve room for the whole packet at once. Escaped characters
+	// may still require more.
+	queue::size_type size = command.length() + 1;
+	for(std::vector<parameter>::size_type i = 0; i < params.size(); ++ i)
+	{
+		if(i < decoded.size() && !decoded[i])
+			size += fields[i + 1] - fields[i];
+		else
+			size += params[i].serialised().length() + 1;
+	}
+
+	queue.reserve(size);
+
 	// Packet command
-	std::string escaped_command = escape(command);
-	queue.append(escaped_command.c_str(), escaped_command.length() );
+	escape(queue, command.data(), command.length() );
 
-	for(std::vector<parameter>::const_iterator iter = params.begin();
-	    iter != params.end();
-	    ++ iter)
+	for(std::vector<parameter>::size_type i = 0; i < params.size(); ++ i)
 	{
 		// Parameter separator
 		queue.append(":", 1);
 
-		// Next parameter
-		std::string escaped_param = escape(iter->serialised() );
-		queue.append(escaped_param.c_str(), escaped_param.length() );
+		if(i < decoded.size() && !decoded[i])
+		{
+			// Parameter has not been touched since it has been
+			// received, so we can forward its escaped form.
+			queue.append(
+				frame.data() + fields[i],
+				fields[i + 1] - fields[i] - 1
+			);
+		}
+		else
+		{
+			// Next parameter
+			const std::string& param = params[i].serialised();
+			escape(queue, param.data(), param.length() );
+		}
 	}
 
 	// Packet separator
 	queue.append("\n", 1);
 }
 
+void net6::packet::index_params() const
+{
+	if(indexed) return;
+	indexed = true;
+
+	// Skip command
+	std::string::size_type pos = frame.find(':');
+	if(pos == std::string::npos) return;
+
+	// Parameters
+	fields.push_back(++ pos);
+	while( (pos = frame.find(':', pos)) != std::string::npos)
+		fields.push_back(++ pos);
+
+	// Last one
+	fields.push_back(frame.length() + 1);
+
+	params.resize(fields.size() - 1, parameter(std::string()) );
+	decoded.resize(fields.size() - 1, false);
+}
+
+bool net6::packet::raw_param(unsigned int index,
+                             const char*& begin,
+                             const char*& end) const
+{
+	index_params();
+
+	if(index < decoded.size() && !decoded[index])
+	{
+		begin = frame.data() + fields[index];
+		end = frame.data() + fields[index + 1] - 1;
+		return true;
+	}
+
+	const std::string& param = params[index].serialised();
+	begin = param.data();
+	end = begin + param.length();
+	return false;
+}
+
 std::string net6::packet::escape(const std::string& string)
 {
 	std::string escaped_string;
@@ -153,17 +225,57 @@ std::string net6::packet::escape(const std::string& string)
 	return escaped_string;
 }
 
+void net6::packet::escape(queue& queue,
+                          const char* data,
+                          queue::size_type len)
+{
+	const char* end = data + len;
+
+	queue::size_type escaped_size = len;
+	for(const char* pos = data; pos != end; ++ pos)
+		if(*pos == '\\' || *pos == '\n' || *pos == ':')
+			++ escaped_size;
+
+	queue.reserve(escaped_size);
+
+	// Copy unescaped runs in one go
+	const char* run = data;
+	for(const char* pos = data; pos != end; ++ pos)
+	{
+		const char* replacement;
+		switch(*pos)
+		{
+		case '\\': replacement = "\\b"; break;
+		case '\n': replacement = "\\n"; break;
+		case ':': replacement = "\\d"; break;
+		default: continue;
+		}
+
+		queue.append(run, pos - run);
+		queue.append(replacement, 2);
+		run = pos + 1;
+	}
+
+	queue.append(run, end - run);
+}
+
 std::string net6::packet::unescape(const std::string& string)
 {
-	std::string unescaped_string;
+	return unescape(string.data(), string.data() + string.length() );
+}
 
-	std::string::size_type unescaped_size = string.size();
-	std::string::size_type pos = 0;
-	while( (pos = string.find('\\', pos)) != std::string::npos )
+std::string net6::packet::unescape(const char* begin, const char* end)
+{
+	// Nothing to unescape
+	if(std::find(begin, end, '\\') == end)
+		return std::string(begin, end);
+
+	std::string::size_type unescaped_size = end - begin;
+	for(const char* pos = begin; pos != end; ++ pos)
 	{
-		if(pos < string.length() - 1)
+		if(*pos == '\\' && pos + 1 != end)
 		{
-			switch(string[pos + 1])
+			switch(pos[1])
 			{
 			case 'b':
 			case 'n':
@@ -171,15 +283,13 @@ std::string net6::packet::unescape(const std::string& string)
 				--unescaped_size;
 			}
 		}
-		++pos;
 	}
 
+	std::string unescaped_string;
 	unescaped_string.resize(unescaped_size);
 
 	std::string::iterator p = unescaped_string.begin();
-	for(std::string::const_iterator iter = string.begin();
-	     iter != string.end();
-	     ++iter)
+	for(const char* iter = begin; iter != end; ++ iter)
 	{
 		char c = *iter;
 		if(c != '\\')
@@ -187,9 +297,9 @@ std::string net6::packet::unescape(const std::string& string)
 			*(p++) = c;
 			continue;
 		}
-		
-		if (++iter == string.end()) break;
-		
+
+		if (++iter == end) break;
+
 		c = *iter;
 		switch(c)
 		{
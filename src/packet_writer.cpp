@@ -0,0 +1,172 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstring>
+
+#include "packet_writer.hpp"
+
+net6::packet_writer::packet_writer(connection_base& conn,
+                                   const char* command,
+                                   queue::size_type size_hint):
+	conn(conn), sendqueue(conn.sendqueue), committed(false)
+{
+	begin(command, std::strlen(command), size_hint);
+}
+
+net6::packet_writer::packet_writer(connection_base& conn,
+                                   const std::string& command,
+                                   queue::size_type size_hint):
+	conn(conn), sendqueue(conn.sendqueue), committed(false)
+{
+	begin(command.data(), command.length(), size_hint);
+}
+
+net6::packet_writer::~packet_writer()
+{
+	// Drop incomplete packet. The connection might have been closed in
+	// the meanwhile in which case the queue has already been cleared.
+	if(!committed && sendqueue.get_total_size() >= begin_pos)
+		sendqueue.truncate(begin_pos);
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(const std::string& value)
+{
+	add_raw(value.data(), value.length() );
+	return *this;
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(const char* value)
+{
+	add_raw(value, std::strlen(value) );
+	return *this;
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(bool value)
+{
+	add_raw(value ? "1" : "0", 1);
+	return *this;
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(int value)
+{
+	add_hex(static_cast<unsigned int>(value) );
+	return *this;
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(unsigned int value)
+{
+	add_hex(value);
+	return *this;
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(long value)
+{
+	add_hex(static_cast<unsigned long>(value) );
+	return *this;
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(unsigned long value)
+{
+	add_hex(value);
+	return *this;
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(short value)
+{
+	add_hex(static_cast<unsigned short>(value) );
+	return *this;
+}
+
+net6::packet_writer& net6::packet_writer::operator<<(unsigned short value)
+{
+	add_hex(value);
+	return *this;
+}
+
+void net6::packet_writer::commit()
+{
+	if(committed)
+	{
+		throw std::logic_error(
+			"net6::packet_writer::commit:\n"
+			"Packet has already been committed"
+		);
+	}
+
+	sendqueue.append("\n", 1);
+	committed = true;
+
+	++ conn.stats.packets_out;
+
+	conn.select_outgoing();
+}
+
+void net6::packet_writer::begin(const char* command,
+                                queue::size_type len,
+                                queue::size_type size_hint)
+{
+	if(conn.state == connection_base::CLOSED)
+	{
+		throw std::logic_error(
+			"net6::packet_writer::packet_writer:\n"
+			"Connection is closed"
+		);
+	}
+
+	if(conn.flush != connection_base::FLUSH_NONE)
+	{
+		throw std::logic_error(
+			"net6::packet_writer::packet_writer:\n"
+			"Connection is being closed"
+		);
+	}
+
+	// The packet is sent in order with normal packets
+	conn.schedule_all(connection_base::PRIORITY_NORMAL);
+
+	// Note that the queue might be blocked, the packet is appended
+	// behind the blocked data nevertheless.
+	begin_pos = sendqueue.get_total_size();
+	if(size_hint > 0) sendqueue.reserve(size_hint);
+
+	packet::escape(sendqueue, command, len);
+}
+
+void net6::packet_writer::add_raw(const char* data, queue::size_type len)
+{
+	sendqueue.append(":", 1);
+	packet::escape(sendqueue, data, len);
+}
+
+void net6::packet_writer::add_hex(unsigned long value)
+{
+	static const char digits[] = "0123456789abcdef";
+
+	char buffer[sizeof(unsigned long) * 2];
+	char* pos = buffer + sizeof(buffer);
+
+	do
+	{
+		*(-- pos) = digits[value & 0xf];
+		value >>= 4;
+	} while(value != 0);
+
+	// Hexadecimal digits never need to be escaped
+	sendqueue.append(":", 1);
+	sendqueue.append(pos, buffer + sizeof(buffer) - pos);
+}
@@ -18,6 +18,7 @@
 
 #include <cstring>
 #include <stdexcept>
+#include <utility>
 
 #include "queue.hpp"
 
@@ -45,13 +46,21 @@ net6::queue::size_type net6::queue::get_size() const
 	return block_p == INVALID_POS ? size : block_p;
 }
 
-net6::queue::size_type net6::queue::packet_size() const
+net6::queue::size_type net6::queue::get_total_size() const
 {
-	for(size_type i = 0; i < size; ++ i)
-		if(data[i] == '\n')
-			return i;
+	return size;
+}
+
+net6::queue::size_type net6::queue::packet_size(size_type from) const
+{
+	if(from >= size)
+		return get_size();
+
+	const void* pos = std::memchr(data + from, '\n', size - from);
+	if(pos == NULL)
+		return get_size();
 
-	return get_size();
+	return static_cast<const char*>(pos) - data;
 }
 
 const char* net6::queue::get_data() const
@@ -88,6 +97,27 @@ void net6::queue::prepend(const char* new_data, size_type len)
 		block_p += len;
 }
 
+void net6::queue::append_unblocked(const char* new_data, size_type len)
+{
+	if(block_p == INVALID_POS)
+	{
+		append(new_data, len);
+		return;
+	}
+
+	if(size + len > alloc)
+	{
+		alloc = size + len;
+		data = static_cast<char*>(std::realloc(data, alloc *= 2) );
+	}
+
+	std::memmove(data + block_p + len, data + block_p, size - block_p);
+	std::memcpy(data + block_p, new_data, len);
+
+	size += len;
+	block_p += len;
+}
+
 void net6::queue::remove(size_type len)
 {
 	if(len > get_size())
@@ -105,6 +135,54 @@ void net6::queue::remove(size_type len)
 		block_p -= len;
 }
 
+char* net6::queue::reserve(size_type len)
+{
+	if(size + len > alloc)
+	{
+		alloc = size + len;
+		data = static_cast<char*>(std::realloc(data, alloc *= 2) );
+	}
+
+	return data + size;
+}
+
+void net6::queue::commit(size_type len)
+{
+	if(size + len > alloc)
+	{
+		throw std::logic_error(
+			"net6::queue::commit:\n"
+			"Cannot commit more data than has been reserved"
+		);
+	}
+
+	size += len;
+}
+
+void net6::queue::truncate(size_type len)
+{
+	if(len > size)
+	{
+		throw std::logic_error(
+			"net6::queue::truncate:\n"
+			"Cannot truncate queue to more data than there is"
+		);
+	}
+
+	size = len;
+
+	if(block_p != INVALID_POS && block_p > size)
+		block_p = size;
+}
+
+void net6::queue::swap(queue& other)
+{
+	std::swap(data, other.data);
+	std::swap(size, other.size);
+	std::swap(alloc, other.alloc);
+	std::swap(block_p, other.block_p);
+}
+
 void net6::queue::block()
 {
 	block_p = size;
@@ -114,3 +192,8 @@ void net6::queue::unblock()
 {
 	block_p = INVALID_POS;
 }
+
+bool net6::queue::is_blocked() const
+{
+	return block_p != INVALID_POS;
+}
@@ -18,7 +18,7 @@
 
 #include "config.hpp"
 
-#include <ctime>
+#include <chrono>
 #include <limits>
 #ifdef HAVE_SYS_SELECT_H
 # include <sys/select.h>
@@ -29,23 +29,16 @@
 
 namespace
 {
-	inline unsigned long time()
-	{
-		static std::time_t begin = 0;
-		if(begin == 0) begin = std::time(NULL);
-
-		return (std::time(NULL) - begin) * 1000;
-	}
-
-	// TODO: Subsecond time resolution...
+	// Milliseconds since the first call, from a clock that is not
+	// affected by changes of the system time.
 	unsigned long msec()
 	{
-		static unsigned long(*time_func)() = NULL;
-
-		if(time_func == NULL)
-			time_func = &time;
+		typedef std::chrono::steady_clock clock_type;
+		static const clock_type::time_point begin = clock_type::now();
 
-		return time_func();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			clock_type::now() - begin
+		).count();
 	}
 
 	unsigned long time_elapsed(unsigned long since, unsigned long now)
@@ -59,6 +52,21 @@ namespace
 	}
 }
 
+net6::selector::selector():
+	running(false), policy(FLUSH_NEXT_SELECT), dispatching(false)
+{
+}
+
+void net6::selector::set_flush_policy(flush_policy new_policy)
+{
+	policy = new_policy;
+}
+
+net6::selector::flush_policy net6::selector::get_flush_policy() const
+{
+	return policy;
+}
+
 net6::io_condition net6::selector::get(const socket& sock) const
 {
 	map_type::const_iterator iter = sock_map.find(&sock);
@@ -74,6 +82,16 @@ void net6::selector::set(const socket& sock,
 {
 	map_type::iterator iter = sock_map.find(&sock);
 
+	// Remember sockets that got data to send while dispatching
+	if(dispatching)
+	{
+		if( (condition & IO_OUTGOING) == IO_NONE)
+			flush_set.erase(&sock);
+		else if(iter == sock_map.end() ||
+		        (iter->second.condition & IO_OUTGOING) == IO_NONE)
+			flush_set.insert(&sock);
+	}
+
 	if(condition != IO_NONE)
 	{
 		if(iter == sock_map.end() )
@@ -277,15 +295,72 @@ void net6::selector::select_impl(timeval* tv)
 			temp_map[sock] = conds;
 	}
 
-	for(std::map<const socket*, io_condition>::const_iterator iter =
-		temp_map.begin();
-	    iter != temp_map.end();
+	dispatching = (policy == FLUSH_END_OF_ITERATION);
+
+	try
+	{
+		for(std::map<const socket*, io_condition>::const_iterator iter =
+			temp_map.begin();
+		    iter != temp_map.end();
+		    ++ iter)
+		{
+			// Socket has been removed from the selector by the
+			// execution of a previous signal handler.
+			if(sock_map.find(iter->first) == sock_map.end() )
+				continue;
+
+			iter->first->io_event().emit(iter->second);
+		}
+	}
+	catch(...)
+	{
+		dispatching = false;
+		flush_set.clear();
+		throw;
+	}
+
+	dispatching = false;
+	if(!flush_set.empty() )
+		flush_impl();
+}
+
+void net6::selector::flush_impl()
+{
+	socket::socket_type max_fd = 0;
+	fd_set writefs;
+	FD_ZERO(&writefs);
+
+	std::set<const socket*> sockets;
+	sockets.swap(flush_set);
+
+	for(std::set<const socket*>::const_iterator iter = sockets.begin();
+	    iter != sockets.end();
 	    ++ iter)
 	{
-		// Socket has been removed from the selector by the execution
-		// of a previous signal handler.
-		if(sock_map.find(iter->first) == sock_map.end() ) continue;
+		max_fd = std::max((*iter)->cobj(), max_fd);
+		FD_SET((*iter)->cobj(), &writefs);
+	}
+
+	// Only poll which of them are writable
+	timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+
+	if(::select(max_fd + 1, NULL, &writefs, NULL, &tv) == -1)
+		throw error(net6::error::SYSTEM);
 
-		iter->first->io_event().emit(iter->second);
+	for(std::set<const socket*>::const_iterator iter = sockets.begin();
+	    iter != sockets.end();
+	    ++ iter)
+	{
+		// Socket has been removed or is no longer selected for
+		// IO_OUTGOING after a previous signal handler ran.
+		map_type::const_iterator map_iter = sock_map.find(*iter);
+		if(map_iter == sock_map.end() ) continue;
+		if( (map_iter->second.condition & IO_OUTGOING) == IO_NONE)
+			continue;
+
+		if(FD_ISSET((*iter)->cobj(), &writefs) )
+			(*iter)->io_event().emit(IO_OUTGOING);
 	}
 }
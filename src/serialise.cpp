@@ -16,8 +16,272 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <cerrno>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <utility>
+
 #include "serialise.hpp"
 
+namespace
+{
+	const char* const DIGITS = "0123456789abcdef";
+
+	// Value of a digit character, or 16 if it is not a digit
+	const unsigned char DIGIT_VALUES[256] = {
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 16, 16, 16, 16, 16, 16,
+		16, 10, 11, 12, 13, 14, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 10, 11, 12, 13, 14, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+		16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16
+	};
+
+	template<typename data_type>
+	serialise::conversion_error make_error(const char* begin,
+	                                       const char* end,
+	                                       const char* reason)
+	{
+		return serialise::conversion_error(
+			"Could not convert \"" + std::string(begin, end) +
+			"\" to " + serialise::type_name<data_type>::name + ": " +
+			reason
+		);
+	}
+
+	template<typename data_type>
+	char* format_number(char* buf,
+	                    data_type from,
+	                    unsigned int base,
+	                    std::true_type /* integral */)
+	{
+		typedef typename std::make_unsigned<data_type>::type
+			unsigned_type;
+
+		unsigned_type value = static_cast<unsigned_type>(from);
+		bool negative = (base == 10 && from < data_type() );
+		if(negative) value = unsigned_type() - value;
+
+		// Digits are produced backwards
+		char digits[std::numeric_limits<unsigned_type>::digits];
+		char* end = digits + sizeof(digits);
+		char* pos = end;
+
+		if(base == 16)
+		{
+			// Avoid the division in the common case
+			do
+			{
+				*(-- pos) = DIGITS[value & 0xf];
+				value >>= 4;
+			} while(value != 0);
+		}
+		else
+		{
+			do
+			{
+				*(-- pos) = DIGITS[value % base];
+				value /= base;
+			} while(value != 0);
+		}
+
+		if(negative) *(buf ++) = '-';
+		std::memcpy(buf, pos, end - pos);
+		return buf + (end - pos);
+	}
+
+	template<>
+	char* format_number<bool>(char* buf,
+	                          bool from,
+	                          unsigned int,
+	                          std::true_type)
+	{
+		*(buf ++) = from ? '1' : '0';
+		return buf;
+	}
+
+	int print_float(char* buf, std::size_t len, double from)
+	{
+		return std::snprintf(buf, len, "%g", from);
+	}
+
+	int print_float(char* buf, std::size_t len, long double from)
+	{
+		return std::snprintf(buf, len, "%Lg", from);
+	}
+
+	template<typename data_type>
+	char* format_number(char* buf,
+	                    data_type from,
+	                    unsigned int,
+	                    std::false_type /* floating point */)
+	{
+		// %g uses the precision of a default std::ostream
+		typedef serialise::numeric_conversion<data_type> conversion;
+		int len = print_float(buf, conversion::max_length, from);
+
+		// The C library uses the decimal point of the current locale
+		const char* point = std::localeconv()->decimal_point;
+		if(point[0] != '.' || point[1] != '\0')
+		{
+			char* pos = std::strstr(buf, point);
+			if(pos != NULL)
+			{
+				std::size_t point_len = std::strlen(point);
+				*pos = '.';
+				std::memmove(
+					pos + 1,
+					pos + point_len,
+					buf + len - pos - point_len
+				);
+
+				len -= static_cast<int>(point_len - 1);
+			}
+		}
+
+		return buf + len;
+	}
+
+	template<typename data_type>
+	data_type parse_number(const char* begin,
+	                       const char* end,
+	                       unsigned int base,
+	                       std::true_type /* integral */)
+	{
+		typedef typename std::make_unsigned<data_type>::type
+			unsigned_type;
+
+		const bool is_signed = std::numeric_limits<data_type>::is_signed;
+		const unsigned_type max = std::numeric_limits<unsigned_type>::max();
+
+		const char* pos = begin;
+		bool negative = false;
+		if(is_signed && pos != end && *pos == '-')
+		{
+			negative = true;
+			++ pos;
+		}
+
+		if(pos == end)
+			throw make_error<data_type>(begin, end, "not a number");
+
+		unsigned_type value = 0;
+		for(; pos != end; ++ pos)
+		{
+			unsigned int digit =
+				DIGIT_VALUES[static_cast<unsigned char>(*pos)];
+
+			if(digit >= base)
+			{
+				throw make_error<data_type>(
+					begin, end, "not a number"
+				);
+			}
+
+			if(value > (max - digit) / base)
+			{
+				throw make_error<data_type>(
+					begin, end, "out of range"
+				);
+			}
+
+			value = value * base + digit;
+		}
+
+		// Largest absolute value of a positive and a negative number.
+		// Positive numbers in base 16 may use the whole unsigned range
+		// since negative numbers are written that way.
+		const unsigned_type max_positive =
+			(is_signed && base == 10) ? max / 2 : max;
+		const unsigned_type max_negative =
+			is_signed ? max / 2 + 1 : 0;
+
+		if(value > (negative ? max_negative : max_positive) )
+			throw make_error<data_type>(begin, end, "out of range");
+
+		if(negative) value = unsigned_type() - value;
+		return static_cast<data_type>(value);
+	}
+
+	template<>
+	bool parse_number<bool>(const char* begin,
+	                        const char* end,
+	                        unsigned int,
+	                        std::true_type)
+	{
+		if(end - begin == 1)
+		{
+			if(*begin == '1') return true;
+			if(*begin == '0') return false;
+		}
+
+		throw make_error<bool>(begin, end, "not a boolean value");
+	}
+
+	void scan_float(const char* str, char** end, float& value)
+	{
+		value = std::strtof(str, end);
+	}
+
+	void scan_float(const char* str, char** end, double& value)
+	{
+		value = std::strtod(str, end);
+	}
+
+	void scan_float(const char* str, char** end, long double& value)
+	{
+		value = std::strtold(str, end);
+	}
+
+	template<typename data_type>
+	data_type parse_number(const char* begin,
+	                       const char* end,
+	                       unsigned int,
+	                       std::false_type /* floating point */)
+	{
+		// strtod would skip whitespace
+		if(begin == end || *begin == ' ' || (*begin >= '\t' &&
+		   *begin <= '\r'))
+			throw make_error<data_type>(begin, end, "not a number");
+
+		// The C library expects the decimal point of the current locale
+		std::string text(begin, end);
+		const char* point = std::localeconv()->decimal_point;
+		if(point[0] != '.' || point[1] != '\0')
+		{
+			std::string::size_type pos = text.find('.');
+			if(pos != std::string::npos)
+				text.replace(pos, 1, point);
+		}
+
+		char* text_end;
+		errno = 0;
+		data_type value;
+		scan_float(text.c_str(), &text_end, value);
+
+		if(text_end != text.c_str() + text.length() )
+			throw make_error<data_type>(begin, end, "not a number");
+
+		if(errno == ERANGE && (value > 1 || value < -1) )
+			throw make_error<data_type>(begin, end, "out of range");
+
+		return value;
+	}
+}
+
 const char* serialise::type_name<int>::name = "int";
 const char* serialise::type_name<long>::name = "long";
 const char* serialise::type_name<short>::name = "short";
@@ -41,11 +305,21 @@ serialise::data::data(const std::string& serialised):
 {
 }
 
+serialise::data::data(std::string&& serialised):
+	m_serialised(std::move(serialised) )
+{
+}
+
 const std::string& serialise::data::serialised() const
 {
 	return m_serialised;
 }
 
+void serialise::data::append_to(std::string& to) const
+{
+	to += m_serialised;
+}
+
 std::string serialise::default_context_to<std::string>::
 	to_string(const data_type& from) const
 {
@@ -59,8 +333,63 @@ serialise::default_context_from<std::string>::
 	return from;
 }
 
+void serialise::default_context_to<std::string>::
+	append_to(std::string& to, const data_type& from) const
+{
+	to += from;
+}
+
 std::string serialise::default_context_to<const char*>::
 	to_string(const data_type& from) const
 {
 	return from;
 }
+
+void serialise::default_context_to<const char*>::
+	append_to(std::string& to, const data_type& from) const
+{
+	to += from;
+}
+
+template<typename data_type>
+char* serialise::numeric_conversion<data_type>::
+	write(char* buf, data_type from, unsigned int base)
+{
+	return format_number(
+		buf,
+		from,
+		base,
+		typename std::is_integral<data_type>::type()
+	);
+}
+
+template<typename data_type>
+std::string serialise::numeric_conversion<data_type>::
+	to_string(data_type from, unsigned int base)
+{
+	char buf[max_length];
+	return std::string(buf, write(buf, from, base) );
+}
+
+template<typename data_type>
+data_type serialise::numeric_conversion<data_type>::
+	from_string(const char* begin, const char* end, unsigned int base)
+{
+	return parse_number<data_type>(
+		begin,
+		end,
+		base,
+		typename std::is_integral<data_type>::type()
+	);
+}
+
+template struct serialise::numeric_conversion<int>;
+template struct serialise::numeric_conversion<long>;
+template struct serialise::numeric_conversion<short>;
+template struct serialise::numeric_conversion<unsigned int>;
+template struct serialise::numeric_conversion<unsigned long>;
+template struct serialise::numeric_conversion<unsigned short>;
+template struct serialise::numeric_conversion<float>;
+template struct serialise::numeric_conversion<double>;
+template struct serialise::numeric_conversion<long double>;
+template struct serialise::numeric_conversion<bool>;
@@ -16,6 +16,8 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <algorithm>
+
 #include "config.hpp"
 
 #include "error.hpp"
@@ -24,10 +26,25 @@
 #ifdef WIN32
 # define WIN32_CAST_FIX(a) (static_cast<char*>(a) )
 # define WIN32_CCAST_FIX(a) (static_cast<const char*>(a) )
+# include <io.h>
 #else
 # define WIN32_CAST_FIX(a) (a)
 # define WIN32_CCAST_FIX(a) (a)
 # include <unistd.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <netinet/tcp.h>
+# include <sys/ioctl.h>
+#endif
+
+#ifdef __linux__
+# include <linux/errqueue.h>
+# include <sys/sendfile.h>
+#endif
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+# define NET6_HAVE_ZEROCOPY 1
 #endif
 
 namespace
@@ -70,6 +87,71 @@ namespace
 #endif
 	}
 
+	void set_int_option(net6::tcp_socket::socket_type socket,
+	                    int level,
+	                    int option,
+	                    int value)
+	{
+		if(setsockopt(socket, level, option, WIN32_CCAST_FIX(
+				static_cast<const void*>(&value)),
+				sizeof(int)) == -1)
+			throw net6::error(net6::error::SYSTEM);
+	}
+
+	int get_int_option(net6::tcp_socket::socket_type socket,
+	                   int level,
+	                   int option)
+	{
+		int value;
+		socklen_t len = sizeof(int);
+		if(getsockopt(socket, level, option, WIN32_CAST_FIX(
+				static_cast<void*>(&value)),
+				&len) == -1)
+			throw net6::error(net6::error::SYSTEM);
+
+		return value;
+	}
+
+	// Sets a TCP level option, returns false if the socket does not
+	// support it.
+	bool set_tcp_option(net6::tcp_socket::socket_type socket,
+	                    int option,
+	                    int value)
+	{
+		if(setsockopt(socket, IPPROTO_TCP, option,
+				WIN32_CCAST_FIX(
+				static_cast<const void*>(&value)),
+				sizeof(int)) == -1)
+		{
+#ifndef WIN32
+			// Not a TCP socket, for example AF_UNIX
+			if(errno == EOPNOTSUPP || errno == ENOPROTOOPT)
+				return false;
+#endif
+
+			throw net6::error(net6::error::SYSTEM);
+		}
+
+		return true;
+	}
+
+	void set_nonblocking(net6::tcp_socket::socket_type socket,
+	                     bool enable)
+	{
+#ifdef WIN32
+		u_long iMode = enable ? 1 : 0;
+		if(ioctlsocket(socket, FIONBIO, &iMode) == SOCKET_ERROR)
+			throw net6::error(net6::error::SYSTEM);
+#else
+		int flags = fcntl(socket, F_GETFL);
+		if(enable) flags |= O_NONBLOCK;
+		else flags &= ~O_NONBLOCK;
+
+		if(fcntl(socket, F_SETFL, flags) == -1)
+			throw net6::error(net6::error::SYSTEM);
+#endif
+	}
+
 #ifndef WIN32
 	const int INVALID_SOCKET = -1;
 #endif
@@ -114,11 +196,47 @@ net6::tcp_socket::tcp_socket(socket_type c_object):
 {
 }
 
+void net6::tcp_socket::set_send_buffer(size_type size)
+{
+	set_int_option(cobj(), SOL_SOCKET, SO_SNDBUF, size);
+}
+
+net6::socket::size_type net6::tcp_socket::get_send_buffer() const
+{
+	return get_int_option(cobj(), SOL_SOCKET, SO_SNDBUF);
+}
+
+void net6::tcp_socket::set_receive_buffer(size_type size)
+{
+	set_int_option(cobj(), SOL_SOCKET, SO_RCVBUF, size);
+}
+
+net6::socket::size_type net6::tcp_socket::get_receive_buffer() const
+{
+	return get_int_option(cobj(), SOL_SOCKET, SO_RCVBUF);
+}
+
 net6::tcp_client_socket::tcp_client_socket(const address& addr):
+	tcp_client_socket(addr, true)
+{
+}
+
+net6::tcp_client_socket::tcp_client_socket(const address& addr,
+                                           bool blocking):
 	tcp_socket(addr)
 {
+	if(!blocking)
+		set_nonblocking(cobj(), true);
+
 	if(::connect(cobj(), addr.cobj(), addr.get_size()) == -1)
-		throw error(net6::error::SYSTEM);
+	{
+#ifdef WIN32
+		if(blocking || WSAGetLastError() != WSAEWOULDBLOCK)
+#else
+		if(blocking || errno != EINPROGRESS)
+#endif
+			throw error(net6::error::SYSTEM);
+	}
 
 	set_nosigpipe(cobj() );
 }
@@ -133,8 +251,40 @@ net6::tcp_client_socket::~tcp_client_socket()
 {
 }
 
+void net6::tcp_client_socket::finish_connect()
+{
+	int result = get_int_option(cobj(), SOL_SOCKET, SO_ERROR);
+	if(result != 0)
+		throw error(net6::error::SYSTEM, result);
+
+	set_nonblocking(cobj(), false);
+}
+
 net6::socket::size_type net6::tcp_client_socket::send(const void* buf,
                                                       size_type len) const
+{
+	size_type sent;
+	error::code code = try_send(buf, len, sent);
+	if(code != error::NONE)
+		throw error(code);
+
+	return sent;
+}
+
+net6::socket::size_type net6::tcp_client_socket::recv(void* buf,
+                                                      size_type len) const
+{
+	size_type received;
+	error::code code = try_recv(buf, len, received);
+	if(code != error::NONE)
+		throw error(code);
+
+	return received;
+}
+
+net6::error::code net6::tcp_client_socket::try_send(const void* buf,
+                                                    size_type len,
+                                                    size_type& sent) const
 {
 	ssize_t result = ::send(
 		cobj(),
@@ -148,13 +298,16 @@ net6::socket::size_type net6::tcp_client_socket::send(const void* buf,
 	);
 
 	if(result < 0)
-		throw error(net6::error::SYSTEM);
+		return error::translate(error::SYSTEM);
 
-	return result;
+	sent = result;
+	return error::NONE;
 }
 
-net6::socket::size_type net6::tcp_client_socket::recv(void* buf,
-                                                      size_type len) const
+net6::error::code net6::tcp_client_socket::try_recv(void* buf,
+                                                    size_type len,
+                                                    size_type& received)
+	const
 {
 	ssize_t result = ::recv(
 		cobj(),
@@ -168,18 +321,304 @@ net6::socket::size_type net6::tcp_client_socket::recv(void* buf,
 	);
 
 	if(result < 0)
+		return error::translate(error::SYSTEM);
+
+	received = result;
+	return error::NONE;
+}
+
+net6::socket::size_type net6::tcp_client_socket::get_available() const
+{
+#ifdef WIN32
+	u_long value;
+	if(ioctlsocket(cobj(), FIONREAD, &value) == SOCKET_ERROR)
+		throw error(net6::error::SYSTEM);
+#else
+	int value;
+	if(ioctl(cobj(), FIONREAD, &value) == -1)
+		throw error(net6::error::SYSTEM);
+#endif
+
+	return value;
+}
+
+bool net6::tcp_client_socket::is_readable() const
+{
+#ifdef MSG_DONTWAIT
+	char c;
+	ssize_t result = ::recv(cobj(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if(result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+		return false;
+#endif
+
+	// recv() reports errors
+	return true;
+}
+
+void net6::tcp_client_socket::shutdown_send() const
+{
+#ifdef WIN32
+	if(::shutdown(cobj(), SD_SEND) == SOCKET_ERROR)
+#else
+	if(::shutdown(cobj(), SHUT_WR) == -1)
+#endif
+		throw error(net6::error::SYSTEM);
+}
+
+bool net6::tcp_client_socket::set_zerocopy(bool enable)
+{
+#ifdef NET6_HAVE_ZEROCOPY
+	int value = enable ? 1 : 0;
+	if(setsockopt(cobj(), SOL_SOCKET, SO_ZEROCOPY, &value,
+	              sizeof(int)) == -1)
+	{
+		// Old kernel or not a TCP socket
+		if(errno == EOPNOTSUPP || errno == ENOPROTOOPT)
+			return false;
+
+		throw error(net6::error::SYSTEM);
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool net6::tcp_client_socket::send_zerocopy(const void* buf,
+                                            size_type len,
+                                            size_type& sent) const
+{
+#ifdef NET6_HAVE_ZEROCOPY
+	ssize_t result = ::send(
+		cobj(),
+		buf,
+		len,
+# ifdef HAVE_MSG_NOSIGNAL
+		MSG_ZEROCOPY | MSG_NOSIGNAL
+# else
+		MSG_ZEROCOPY
+# endif
+	);
+
+	if(result >= 0)
+	{
+		sent = result;
+		return true;
+	}
+
+	// Out of memory to pin the pages: Copy instead
+	if(errno != ENOBUFS)
+		throw error(net6::error::SYSTEM);
+#endif
+
+	sent = send(buf, len);
+	return false;
+}
+
+net6::socket::size_type net6::tcp_client_socket::send_file(int fd,
+                                                           off_t offset,
+                                                           size_type len)
+	const
+{
+#ifdef __linux__
+	ssize_t result = ::sendfile(cobj(), fd, &offset, len);
+	if(result == -1)
 		throw error(net6::error::SYSTEM);
 
 	return result;
+#else
+	char buf[64 * 1024];
+	len = std::min<size_type>(len, sizeof(buf) );
+
+# ifdef WIN32
+	if(lseek(fd, offset, SEEK_SET) == -1)
+		throw error(net6::error::SYSTEM);
+	int result = ::read(fd, buf, len);
+# else
+	ssize_t result = ::pread(fd, buf, len, offset);
+# endif
+	if(result == -1)
+		throw error(net6::error::SYSTEM);
+	if(result == 0)
+		return 0;
+
+	// Data that is read but not sent is read again next time
+	return send(buf, result);
+#endif
+}
+
+unsigned long net6::tcp_client_socket::read_zerocopy_completions() const
+{
+	unsigned long completed = 0;
+
+#ifdef NET6_HAVE_ZEROCOPY
+	while(true)
+	{
+		char control[128];
+		msghdr msg = msghdr();
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if(recvmsg(cobj(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+		{
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			throw error(net6::error::SYSTEM);
+		}
+
+		for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		    cmsg != NULL;
+		    cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if(!(cmsg->cmsg_level == IPPROTO_IP &&
+			     cmsg->cmsg_type == IP_RECVERR) &&
+			   !(cmsg->cmsg_level == IPPROTO_IPV6 &&
+			     cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			const sock_extended_err* err =
+				reinterpret_cast<const sock_extended_err*>(
+					CMSG_DATA(cmsg)
+				);
+
+			if(err->ee_errno != 0 ||
+			   err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			// Sends ee_info to ee_data completed
+			completed += err->ee_data - err->ee_info + 1;
+		}
+	}
+#endif
+
+	return completed;
+}
+
+bool net6::tcp_client_socket::set_nodelay(bool enable)
+{
+	return set_tcp_option(cobj(), TCP_NODELAY, enable ? 1 : 0);
 }
 
-net6::tcp_server_socket::tcp_server_socket(const address& bind_addr):
+bool net6::tcp_client_socket::set_quickack(bool enable)
+{
+#ifdef TCP_QUICKACK
+	return set_tcp_option(cobj(), TCP_QUICKACK, enable ? 1 : 0);
+#else
+	return false;
+#endif
+}
+
+bool net6::tcp_client_socket::set_notsent_lowat(size_type size)
+{
+#ifdef TCP_NOTSENT_LOWAT
+	return set_tcp_option(cobj(), TCP_NOTSENT_LOWAT, size);
+#else
+	return false;
+#endif
+}
+
+bool net6::tcp_client_socket::set_user_timeout(unsigned long timeout)
+{
+#ifdef TCP_USER_TIMEOUT
+	return set_tcp_option(cobj(), TCP_USER_TIMEOUT, timeout);
+#else
+	return false;
+#endif
+}
+
+unsigned long net6::tcp_client_socket::get_user_timeout() const
+{
+#ifdef TCP_USER_TIMEOUT
+	return get_int_option(cobj(), IPPROTO_TCP, TCP_USER_TIMEOUT);
+#else
+	return 0;
+#endif
+}
+
+bool net6::tcp_client_socket::set_keepalive(bool enable,
+                                            unsigned long idle,
+                                            unsigned long interval,
+                                            unsigned int count)
+{
+	if(enable)
+	{
+#if defined(TCP_KEEPIDLE) || defined(TCP_KEEPALIVE)
+		// Round up to whole seconds
+		int idle_sec = static_cast<int>( (idle + 999) / 1000);
+		int interval_sec = static_cast<int>( (interval + 999) / 1000);
+# ifdef TCP_KEEPIDLE
+		const int option = TCP_KEEPIDLE;
+# else
+		// Mac OS X
+		const int option = TCP_KEEPALIVE;
+# endif
+		if(!set_tcp_option(cobj(), option, std::max(idle_sec, 1)) )
+			return false;
+# ifdef TCP_KEEPINTVL
+		set_tcp_option(cobj(), TCP_KEEPINTVL, std::max(interval_sec, 1));
+# endif
+# ifdef TCP_KEEPCNT
+		set_tcp_option(cobj(), TCP_KEEPCNT, count);
+# endif
+#else
+		// The system default waits hours until the first probe
+		return false;
+#endif
+	}
+
+	set_int_option(cobj(), SOL_SOCKET, SO_KEEPALIVE, enable ? 1 : 0);
+	return true;
+}
+
+bool net6::tcp_client_socket::set_cork(bool enable)
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+	int value = enable ? 1 : 0;
+# ifdef TCP_CORK
+	// Linux
+	const int option = TCP_CORK;
+# else
+	// BSD
+	const int option = TCP_NOPUSH;
+# endif
+	if(setsockopt(cobj(), IPPROTO_TCP, option, &value, sizeof(int)) == -1)
+	{
+		// Not a TCP socket, for example AF_UNIX
+		if(errno == EOPNOTSUPP || errno == ENOPROTOOPT)
+			return false;
+
+		throw error(net6::error::SYSTEM);
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+net6::tcp_server_socket::tcp_server_socket(const address& bind_addr,
+                                           int backlog):
+	tcp_server_socket(bind_addr, backlog, tcp_options() )
+{
+}
+
+net6::tcp_server_socket::tcp_server_socket(const address& bind_addr,
+                                           int backlog,
+                                           const tcp_options& options):
 	tcp_socket(bind_addr)
 {
+	// Must be set before listen() to be used for the window scale
+	if(options.send_buffer > 0)
+		set_send_buffer(options.send_buffer);
+	if(options.receive_buffer > 0)
+		set_receive_buffer(options.receive_buffer);
+
 	set_reuseaddr(cobj() );
 	if(bind(cobj(), bind_addr.cobj(), bind_addr.get_size()) == -1)
 		throw error(net6::error::SYSTEM);
-	if(listen(cobj(), 0) == -1)
+	if(listen(cobj(), backlog) == -1)
 		throw error(net6::error::SYSTEM);
 }
 
@@ -188,18 +627,18 @@ net6::tcp_server_socket::tcp_server_socket(socket_type c_object):
 {
 }
 
-std::auto_ptr<net6::tcp_client_socket> net6::tcp_server_socket::accept() const
+std::unique_ptr<net6::tcp_client_socket> net6::tcp_server_socket::accept() const
 {
 	socket_type new_sock = ::accept(cobj(), NULL, NULL);
 	if(new_sock == INVALID_SOCKET)
 		throw error(net6::error::SYSTEM);
 
-	return std::auto_ptr<tcp_client_socket>(
+	return std::unique_ptr<tcp_client_socket>(
 		new tcp_client_socket(new_sock)
 	);
 }
 
-std::auto_ptr<net6::tcp_client_socket>
+std::unique_ptr<net6::tcp_client_socket>
 net6::tcp_server_socket::accept(address& from) const
 {
 	socklen_t sock_size = from.get_size();
@@ -207,7 +646,7 @@ net6::tcp_server_socket::accept(address& from) const
 	if(new_sock == INVALID_SOCKET)
 		throw error(net6::error::SYSTEM);
 
-	return std::auto_ptr<tcp_client_socket>(
+	return std::unique_ptr<tcp_client_socket>(
 		new tcp_client_socket(new_sock)
 	);
 }
@@ -277,3 +716,19 @@ net6::udp_socket::recv(void* buf, size_type len, address& from) const
 
 	return result;
 }
+
+net6::tcp_options::tcp_options():
+	nodelay(false), quickack(false), send_buffer(0), receive_buffer(0),
+	notsent_lowat(0), user_timeout(0)
+{
+}
+
+void net6::tcp_options::apply(tcp_client_socket& sock) const
+{
+	if(nodelay) sock.set_nodelay(true);
+	if(quickack) sock.set_quickack(true);
+	if(send_buffer > 0) sock.set_send_buffer(send_buffer);
+	if(receive_buffer > 0) sock.set_receive_buffer(receive_buffer);
+	if(notsent_lowat > 0) sock.set_notsent_lowat(notsent_lowat);
+	if(user_timeout > 0) sock.set_user_timeout(user_timeout);
+}
@@ -0,0 +1,89 @@
+/* net6 - Library providing IPv4/IPv6 network access
+ * Copyright (C) 2005, 2006 Armin Burgmeier / 0x539 dev group
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#include <limits>
+
+#include "token_bucket.hpp"
+
+net6::token_bucket::token_bucket():
+	rate(0), burst(0), tokens(0.0)
+{
+}
+
+void net6::token_bucket::set_rate(size_type new_rate, size_type new_burst)
+{
+	rate = new_rate;
+	burst = (new_burst > 0) ? new_burst : new_rate;
+
+	tokens = static_cast<double>(burst);
+	last_refill = clock_type::now();
+}
+
+net6::token_bucket::size_type net6::token_bucket::get_rate() const
+{
+	return rate;
+}
+
+net6::token_bucket::size_type net6::token_bucket::get_burst() const
+{
+	return burst;
+}
+
+net6::token_bucket::size_type net6::token_bucket::get_available()
+{
+	if(rate == 0)
+		return std::numeric_limits<size_type>::max();
+
+	refill();
+	if(tokens < 1.0) return 0;
+	return static_cast<size_type>(tokens);
+}
+
+void net6::token_bucket::consume(size_type amount)
+{
+	if(rate == 0) return;
+
+	refill();
+	tokens -= static_cast<double>(amount);
+}
+
+unsigned long net6::token_bucket::get_wait_time(size_type amount)
+{
+	if(rate == 0) return 0;
+
+	refill();
+
+	double wanted = static_cast<double>(amount < burst ? amount : burst);
+	if(tokens >= wanted) return 0;
+
+	// Round up so that the tokens are there when waking up
+	return static_cast<unsigned long>(
+		(wanted - tokens) * 1000.0 / rate
+	) + 1;
+}
+
+void net6::token_bucket::refill()
+{
+	clock_type::time_point now = clock_type::now();
+	std::chrono::duration<double> elapsed = now - last_refill;
+	last_refill = now;
+
+	tokens += elapsed.count() * rate;
+	if(tokens > burst) tokens = static_cast<double>(burst);
+}
@@ -16,6 +16,8 @@
  * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <utility>
+
 #include "error.hpp"
 #include "user.hpp"
 
@@ -98,6 +100,31 @@ void net6::user::send(const packet& pack) const
 	conn->send(pack);
 }
 
+void net6::user::send(packet&& pack) const
+{
+	if(conn.get() == NULL)
+		throw not_connected_error("net6::user::send");
+
+	conn->send(std::move(pack) );
+}
+
+void net6::user::send(const packet& pack, unsigned long token) const
+{
+	if(conn.get() == NULL)
+		throw not_connected_error("net6::user::send");
+
+	conn->send(pack, token);
+}
+
+void net6::user::send(const packet& pack,
+                      connection_base::send_priority priority) const
+{
+	if(conn.get() == NULL)
+		throw not_connected_error("net6::user::send");
+
+	conn->send(pack, priority);
+}
+
 void net6::user::request_encryption() const
 {
 	if(conn.get() == NULL)
@@ -107,6 +134,14 @@ void net6::user::request_encryption() const
 	conn->request_encryption(false);
 }
 
+void net6::user::request_compression() const
+{
+	if(conn.get() == NULL)
+		throw not_connected_error("net6::user::request_compression");
+
+	conn->request_compression();
+}
+
 void net6::user::set_enable_keepalives(bool enable) const
 {
 	if(conn.get() == NULL)
@@ -115,8 +150,33 @@ void net6::user::set_enable_keepalives(bool enable) const
 	conn->set_enable_keepalives(enable);
 }
 
+void net6::user::set_enable_keepalives(bool enable,
+                                       connection_base::keepalive_mode mode)
+	const
+{
+	if(conn.get() == NULL)
+		throw not_connected_error("net6::user::set_enable_keepalives");
+
+	conn->set_enable_keepalives(enable, mode);
+}
+
+void net6::user::close_after_flush(unsigned long timeout) const
+{
+	if(conn.get() == NULL)
+		throw not_connected_error("net6::user::close_after_flush");
+
+	conn->close_after_flush(timeout);
+}
+
 void net6::user::on_encryption_failed()
 {
 	signal_encryption_failed.emit();
 }
 
+net6::connection_stats net6::user::get_stats() const
+{
+	if(conn.get() == NULL)
+		throw not_connected_error("net6::user::get_stats");
+
+	return conn->get_stats();
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <utility>
+#include <sigc++/bind.h>
+
+#include <net6/main.hpp>
+#include <net6/select.hpp>
+#include <net6/connection.hpp>
+
+const int PORT = 35268;
+
+namespace
+{
+	void on_close(bool& closed)
+	{
+		closed = true;
+	}
+
+	// Sends a broken net6_file header and checks that the receiving
+	// connection is closed instead of throwing.
+	bool check(net6::tcp_server_socket& server, const std::string& frame)
+	{
+		net6::selector selector;
+
+		net6::ipv4_address serv_addr =
+			net6::ipv4_address::create_from_hostname(
+				"localhost",
+				PORT
+			);
+
+		net6::tcp_client_socket remote(serv_addr);
+		remote.send(frame.data(), frame.length() );
+
+		net6::ipv4_address client_addr;
+		net6::connection<net6::selector> conn(selector);
+		conn.assign(server.accept(client_addr), client_addr);
+
+		bool closed = false;
+		conn.close_event().connect(
+			sigc::bind(sigc::ptr_fun(&on_close), sigc::ref(closed))
+		);
+
+		try
+		{
+			for(int i = 0; i < 100 && !closed; ++ i)
+				selector.select(10);
+		}
+		catch(std::exception& e)
+		{
+			std::cerr << "Frame " << frame.substr(0, frame.length() - 1)
+			          << " threw: " << e.what() << std::endl;
+			return false;
+		}
+
+		if(closed) return true;
+
+		std::cerr << "Frame " << frame.substr(0, frame.length() - 1)
+		          << " did not close the connection" << std::endl;
+		return false;
+	}
+}
+
+int main() try
+{
+	net6::main kit;
+
+	net6::ipv4_address serv_addr(PORT);
+	net6::tcp_server_socket server(serv_addr);
+
+	bool failed = false;
+	if(!check(server, "net6_file\n") ) failed = true;
+	if(!check(server, "net6_file:5\n") ) failed = true;
+	if(!check(server, "net6_file:five:cmd\n") ) failed = true;
+	if(!check(server, "net6_file:-1:cmd\n") ) failed = true;
+
+	if(failed) return 1;
+
+	std::cout << "All broken headers closed the connection" << std::endl;
+	return 0;
+}
+catch(std::exception& e)
+{
+	std::cerr << e.what() << std::endl;
+	return 1;
+}
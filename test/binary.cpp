@@ -0,0 +1,97 @@
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <net6/binary.hpp>
+#include <net6/sequence.hpp>
+
+namespace
+{
+	bool failed = false;
+
+	template<typename data_type>
+	void check(data_type value)
+	{
+		std::string encoded = serialise::binary<data_type>::to_string(value);
+
+		try
+		{
+			data_type decoded =
+				serialise::binary<data_type>::from_string(encoded);
+
+			if(decoded == value) return;
+
+			std::cerr << serialise::type_name<data_type>::name
+			          << " " << value << " decoded to " << decoded
+			          << std::endl;
+		}
+		catch(serialise::conversion_error& e)
+		{
+			std::cerr << serialise::type_name<data_type>::name
+			          << " " << value << ": " << e.what()
+			          << std::endl;
+		}
+
+		failed = true;
+	}
+
+	template<typename data_type>
+	void check_unsigned()
+	{
+		check<data_type>(0);
+		check<data_type>(1);
+		check<data_type>(127);
+		check<data_type>(128);
+		check<data_type>(std::numeric_limits<data_type>::max() );
+	}
+
+	template<typename data_type>
+	void check_signed()
+	{
+		check_unsigned<data_type>();
+		check<data_type>(-1);
+		check<data_type>(-64);
+		check<data_type>(-65);
+		check<data_type>(-300);
+		check<data_type>(std::numeric_limits<data_type>::min() );
+	}
+}
+
+int main()
+{
+	check_unsigned<unsigned short>();
+	check_unsigned<unsigned int>();
+	check_unsigned<unsigned long>();
+	check_signed<short>();
+	check_signed<int>();
+	check_signed<long>();
+
+	// Vectors store their length as unsigned long
+	std::vector<unsigned int> vec(300, 5u);
+	vec.push_back(std::numeric_limits<unsigned int>::max() );
+	typedef serialise::binary<std::vector<unsigned int> > vec_binary;
+	if(vec_binary::from_string(vec_binary::to_string(vec) ) != vec)
+	{
+		std::cerr << "std::vector<unsigned int> differs" << std::endl;
+		failed = true;
+	}
+
+	// A value that does not fit into the type is rejected
+	std::string too_large = serialise::binary<unsigned long>::to_string(
+		std::numeric_limits<unsigned long>::max() );
+	try
+	{
+		serialise::binary<unsigned int>::from_string(too_large);
+		std::cerr << "Decoded unsigned long max as unsigned int"
+		          << std::endl;
+		failed = true;
+	}
+	catch(serialise::conversion_error& e)
+	{
+	}
+
+	if(failed) return 1;
+
+	std::cout << "All values decoded correctly" << std::endl;
+	return 0;
+}
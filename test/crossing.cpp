@@ -0,0 +1,107 @@
+#include <iostream>
+#include <utility>
+#include <sigc++/bind.h>
+
+#include <net6/main.hpp>
+#include <net6/select.hpp>
+#include <net6/connection.hpp>
+
+const int PORT = 35269;
+
+namespace
+{
+	void on_failed(unsigned int& count)
+	{
+		++ count;
+	}
+
+	void on_recv(const net6::packet& pack, unsigned int& count)
+	{
+		if(pack.get_command() == "data") ++ count;
+	}
+
+	// Lets both sites request something at the same time. Both
+	// requests have to be denied, and packets sent in the meantime
+	// have to arrive afterwards.
+	bool check(net6::tcp_server_socket& server,
+	           bool encryption,
+	           const char* name)
+	{
+		net6::selector selector;
+
+		net6::ipv4_address serv_addr =
+			net6::ipv4_address::create_from_hostname(
+				"localhost",
+				PORT
+			);
+
+		net6::connection<net6::selector> first(selector);
+		first.connect(serv_addr);
+
+		net6::ipv4_address client_addr;
+		net6::connection<net6::selector> second(selector);
+		second.assign(server.accept(client_addr), client_addr);
+
+		unsigned int failed = 0;
+		unsigned int received = 0;
+
+		first.compression_failed_event().connect(
+			sigc::bind(sigc::ptr_fun(&on_failed), sigc::ref(failed))
+		);
+		second.compression_failed_event().connect(
+			sigc::bind(sigc::ptr_fun(&on_failed), sigc::ref(failed))
+		);
+		second.encryption_failed_event().connect(
+			sigc::bind(sigc::ptr_fun(&on_failed), sigc::ref(failed))
+		);
+		first.recv_event().connect(
+			sigc::bind(sigc::ptr_fun(&on_recv), sigc::ref(received))
+		);
+		second.recv_event().connect(
+			sigc::bind(sigc::ptr_fun(&on_recv), sigc::ref(received))
+		);
+
+		first.request_compression();
+		if(encryption)
+			second.request_encryption(false);
+		else
+			second.request_compression();
+
+		net6::packet pack("data");
+		first.send(pack);
+		second.send(pack);
+
+		for(int i = 0; i < 100 && (failed < 2 || received < 2); ++ i)
+			selector.select(10);
+
+		if(failed == 2 && received == 2) return true;
+
+		std::cerr << name << ": " << failed << " requests denied, "
+		          << received << " packets received" << std::endl;
+		return false;
+	}
+}
+
+int main() try
+{
+	net6::main kit;
+
+	net6::ipv4_address serv_addr(PORT);
+	net6::tcp_server_socket server(serv_addr);
+
+	bool failed = false;
+	if(!check(server, false, "Compression and compression") )
+		failed = true;
+	if(!check(server, true, "Compression and encryption") )
+		failed = true;
+
+	if(failed) return 1;
+
+	std::cout << "All crossing requests have been denied" << std::endl;
+	return 0;
+}
+catch(std::exception& e)
+{
+	std::cerr << e.what() << std::endl;
+	return 1;
+}
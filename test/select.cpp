@@ -97,7 +97,7 @@ int main(int argc, char* argv[]) try
 	net6::tcp_server_socket sock(serv_addr);
 
 	net6::ipv4_address client_addr;
-	std::auto_ptr<net6::tcp_client_socket> client =
+	std::unique_ptr<net6::tcp_client_socket> client =
 		sock.accept(client_addr);
 
 	gsock = client.get();
@@ -1,5 +1,6 @@
 
 #include <iostream>
+#include <utility>
 #include <sigc++/bind.h>
 
 #include <net6/main.hpp>
@@ -40,11 +41,11 @@ int main(int argc, char* argv[]) try
 		net6::tcp_server_socket server(serv_addr);
 
 		net6::ipv4_address client_addr;
-		std::auto_ptr<net6::tcp_client_socket> client;
+		std::unique_ptr<net6::tcp_client_socket> client;
 		client = server.accept(client_addr);
 
 		net6::connection<net6::selector> conn(selector);
-		conn.assign(client, client_addr);
+		conn.assign(std::move(client), client_addr);
 		exec(conn, selector);
 	}
 	else